@@ -8,80 +8,103 @@
 ******************************************************************************/
 
 #include <stdio.h>
-#include <stdint.h>
-#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
 #include <argp.h>
+#include <assert.h>
+#include <signal.h>
 #include <unistd.h>
-#include <hip/hip_runtime.h>
 #include <pthread.h>
-#include <numa.h>
-#include <assert.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include "libhits.h"
 
 /* Expand macro values to string */
 #define STR_VALUE(var)  #var
 #define STR(var)        STR_VALUE(var)
 
-#define N_SIZE_MAX      1073741824  /* 1GiB */
-#define N_SIZE_DEFAULT  N_SIZE_MAX
-#define N_ITER_DEFAULT  100
-#define HITS_VERSION    "hits 1.1"
+#define TOLERANCE_DEFAULT       5           /* Percent of bandwidth drop before regression */
+#define EXIT_REGRESSION         2           /* Exit status when a baseline regression is found */
+#define EXIT_UNHEALTHY          3           /* Exit status when a link is degraded */
+#define DAEMON_TIMEOUT          5           /* Seconds to wait for a client request */
+#define DAEMON_REQUEST_MAX      256         /* Maximum length of a request line */
+#define OFFSETS_DEFAULT         "0,1,64,256,4097,4160"
+#define PROBE_INTERVAL_DEFAULT  60          /* Seconds between two probes */
+#define PROBE_SIZE_DEFAULT      (32 << 20)  /* Transfer size of probes */
+#define PROBE_ITER_DEFAULT      4           /* Iterations of probes */
+#define PROBE_DURATION_MAX      0.5         /* Seconds a probe should not exceed */
+#define WORKERS_MAX             64          /* Worker processes of --processes */
+#define WORKERS_START_TIMEOUT   300         /* Seconds for workers to reach the barrier */
+#define WORKERS_POLL_USEC       10000       /* Period at which workers are checked */
+#define WORKER_NAME_MAX         32          /* Length of worker names in messages */
 #define HITS_CONTACT    "https://github.com/jyvet/hits"
 
-#define checkHip(ret) { assertHip((ret), __FILE__, __LINE__); }
-inline void assertHip(hipError_t code, const char *file, int line)
+typedef struct Cli
 {
-   if (code != hipSuccess)
-   {
-      fprintf(stderr,"CheckHip: %s %s %d\n", hipGetErrorString(code), file, line);
-      exit(code);
-   }
-}
-
-typedef enum TransferType
+    Hits_t      hits;          /* Plan built from the command line             */
+    const char *output;        /* Result file to write (NULL if none)          */
+    const char *baseline;      /* Result file to compare with (NULL if none)   */
+    double      tolerance;     /* Accepted bandwidth drop in percent           */
+    const char *socket;        /* UNIX socket of the daemon mode (NULL if none) */
+    bool        is_alloc_bench; /* Benchmark allocations instead of transfers  */
+    const char *trace;         /* Chrome trace file to write (NULL if none)    */
+    const char *prometheus;    /* Metric file of the probe mode (NULL if none) */
+    long        interval;      /* Seconds between two probes                   */
+    bool        is_size_set;   /* Transfer size given on the command line      */
+    bool        is_iter_set;   /* Iterations given on the command line         */
+    bool        is_healthcheck; /* Check links instead of a single run         */
+    bool        is_processes;  /* Also run with one process per GPU            */
+    bool        is_engine_processes; /* Run sdma and blit engines in their own process */
+} Cli_t;
+
+/* Shared between the parent and the worker processes of --processes */
+typedef struct Shared
 {
-    HTOD = 0,  /* Host memory to Device (GPU)  */
-    DTOH,      /* Device (GPU) to Host memory  */
-    DTOD,      /* Device (GPU) to Device (GPU) */
-} TransferType_t;
+    pthread_barrier_t   barrier;            /* Workers start their runs together     */
+    int                 ret[WORKERS_MAX];   /* Exit status of each worker            */
+    int                 arrived[WORKERS_MAX]; /* Workers which reached the barrier   */
+    Result_t            results[];          /* Ordered as by hits_get_results        */
+} Shared_t;
 
-const char * const ttype_str[] =
-{
-    "Host to Device",
-    "Device to Host",
-    "Device to Device",
-};
+/* Set by SIGINT and SIGTERM to stop the daemon */
+static volatile sig_atomic_t is_stopping = 0;
 
-typedef struct Transfer
+/* Keys for options without a short version */
+enum OptionKeys
 {
-    hipEvent_t      start;      /* Start event for timing purpose                */
-    hipEvent_t      stop;       /* Stop event for timing purpose                 */
-    int             device;     /* First (or single) device involved in transfer */
-    int             device2;    /* Second device involved in the transfer        */
-    float          *dest;       /* Source buffer (host or GPU memory)            */
-    float          *src;        /* Destination buffer (host or GPU memory)       */
-    hipStream_t     stream;     /* HIP stream dedicated to the transfer          */
-    TransferType_t  type;       /* Type and direction of the transfer            */
-    int             numa_node;  /* NUMA node locality                            */
-    bool            is_started; /* True if at least one stream event submitted   */
-    struct hipDeviceProp_t prop_device;
-    struct hipDeviceProp_t prop_device2;
-} Transfer_t;
-
-enum Flags
-{
-    is_numa_aware = 1 << 0,
-    is_pinned     = 1 << 1,
+    OPT_STRIDED = 256,
+    OPT_PITCH,
+    OPT_VERIFY,
+    OPT_DEMAND_FAULT,
+    OPT_ENGINE,
+    OPT_PRIORITY,
+    OPT_QOS_PROBE,
+    OPT_QOS_SIZE,
+    OPT_BASELINE,
+    OPT_TOLERANCE,
+    OPT_DAEMON,
+    OPT_ALLOC_BENCH,
+    OPT_WORKING_SET,
+    OPT_OFFSET_SWEEP,
+    OPT_PAGEABLE,
+    OPT_WAIT,
+    OPT_DRAM_COUNTERS,
+    OPT_TRACE,
+    OPT_PROMETHEUS,
+    OPT_INTERVAL,
+    OPT_HEALTHCHECK,
+    OPT_SYSFS_ROOT,
+    OPT_PROCESSES,
 };
 
-typedef struct Hits
-{
-    Transfer_t *transfer;      /* Array containing all transfers to launch     */
-    int         n_transfers;   /* Amount of transfers                          */
-    long        n_iter;        /* Amount of iterations for each transfer       */
-    long        n_size;        /* Transfer size in bytes                       */
-    int         alloc_flags;   /* Allocation flags (NUMA aware and pinned)     */
-} Hits_t;
-
 const char *argp_program_version = HITS_VERSION;
 const char *argp_program_bug_address = HITS_CONTACT;
 
@@ -103,53 +126,204 @@ static struct argp_option options[] =
     {"dtod",                  'p', "<id,id>", 0,  "Provide comma-separated GPU ids to specify which "
                                                   "pair of GPUs to use for peer to peer transfer. "
                                                   "First id is the destination, second id is the source."},
+    {"managed",               'u', "<id>",    0,  "Provide GPU id for managed memory migrations "
+                                                  "(host to device and back each iteration)."},
+    {"demand-fault", OPT_DEMAND_FAULT, 0,     0,  "Migrate managed memory back to the host with CPU "
+                                                  "page faults instead of prefetches."},
     {"iter",                  'i', "<nb>",    0,  "Specify the amount of iterations. [default: "
                                                   STR(N_ITER_DEFAULT) "]"},
     {"disable-numa-affinity", 'n', 0,         0,  "Do not make the transfer buffers NUMA aware."},
     {"disable-pinned-memory", 'm', 0,         0,  "Use pageable allocations instead."},
-    {"size",                  's', "<bytes>", 0,  "Specify the transfer size in bytes. [default: "
-                                                  STR(N_SIZE_DEFAULT) "]"},
+    {"pageable",     OPT_PAGEABLE, "<list>",  0,  "Use pageable allocations mapped with mmap and "
+                                                  "tuned by the comma-separated settings: populate "
+                                                  "(prefault at allocation), hugepage or nohugepage "
+                                                  "(transparent huge page advice) and touch (first "
+                                                  "touch from the GPU NUMA node). Implies -m."},
+    {"size",                  's', "<bytes>", 0,  "Specify the transfer size in bytes. Sizes of all "
+                                                  "options accept K, M, G and T suffixes (16G). "
+                                                  "[default: 1G]"},
+    {"strided",       OPT_STRIDED, "<w,h[,d]>", 0, "Use pitched 2D copies of <h> rows of <w> bytes "
+                                                  "(3D copies of <d> slices if a depth is given) "
+                                                  "instead of linear copies. Overrides --size."},
+    {"pitch",           OPT_PITCH, "<bytes>", 0,  "Specify the row pitch of strided buffers in bytes. "
+                                                  "[default: row width]"},
+    {"working-set", OPT_WORKING_SET, "<bytes>", 0, "Also run each transfer on buffers of <bytes>, "
+                                                  "copying another window of the buffers at each "
+                                                  "iteration so that caches do not hold the data. "
+                                                  "Hot and cold bandwidths are reported together."},
+    {"offset-sweep", OPT_OFFSET_SWEEP, "<list>", OPTION_ARG_OPTIONAL,
+                                              "Instead of a single run, run the transfers for each "
+                                              "pair of source and destination byte offsets of the "
+                                              "comma-separated list and print bandwidth tables. "
+                                              "[default list: " OFFSETS_DEFAULT "]"},
+    {"engine",         OPT_ENGINE, "<list>",  0,  "Provide comma-separated copy engines to compare, "
+                                                  "one run each: auto (runtime copies, on SDMA engines "
+                                                  "or blit kernels as set by HSA_ENABLE_SDMA), sdma "
+                                                  "(runtime copies with HSA_ENABLE_SDMA=1, peer copies "
+                                                  "without compute units), blit (runtime copies with "
+                                                  "HSA_ENABLE_SDMA=0) or kernel (in-tree copy kernel, "
+                                                  "zero-copy for host memory). Compared with other "
+                                                  "engines, sdma and blit run in their own process. "
+                                                  "[default: auto]"},
+    {"zero-copy",             'z', 0,         0,  "Shorthand for --engine=auto,kernel."},
+    {"priority",     OPT_PRIORITY, "<level>", 0,  "Specify the stream priority (high, normal or low) "
+                                                  "of the transfers given after this option. "
+                                                  "[default: normal]"},
+    {"wait",             OPT_WAIT, "<mode>",  0,  "Specify how the host waits for transfer completions: "
+                                                  "auto (device synchronization), spin, yield or "
+                                                  "blocking (device scheduling modes, blocking sync "
+                                                  "events) or callback (host function notifications). "
+                                                  "[default: auto]"},
+    {"qos-probe",   OPT_QOS_PROBE, "<id>",    0,  "Provide GPU id on which small Host to Device copies "
+                                                  "measure latency on a high and a normal priority "
+                                                  "stream, idle and while transfers run."},
+    {"qos-size",     OPT_QOS_SIZE, "<bytes>", 0,  "Specify the size of QoS probe copies in bytes. "
+                                                  "[default: " STR(QOS_SIZE_DEFAULT) "]"},
+    {"output",                'o', "<file>",  0,  "Write results to <file> (CSV, usable as a baseline)."},
+    {"trace",           OPT_TRACE, "<file>",  0,  "Time each iteration and write the copies to <file> "
+                                                  "as Chrome trace-event JSON (chrome://tracing, "
+                                                  "Perfetto), one track per transfer stream."},
+    {"prometheus", OPT_PROMETHEUS, "<file>",  0,  "Run the transfers periodically as short probes ("
+                                                  "32M, 4 iterations unless --size or --iter are "
+                                                  "given) and atomically write a node_exporter "
+                                                  "textfile with bandwidth, copy duration and "
+                                                  "latency quantiles and NUMA placement after each."},
+    {"interval",   OPT_INTERVAL, "<seconds>", 0,  "Specify the delay between two probes of --prometheus. "
+                                                  "[default: " STR(PROBE_INTERVAL_DEFAULT) "]"},
+    {"healthcheck", OPT_HEALTHCHECK, "<pct>", OPTION_ARG_OPTIONAL,
+                                              "Instead of a single run, probe each host transfer "
+                                              "alone (32M, 4 iterations unless --size or --iter are "
+                                              "given) and exit with status " STR(EXIT_UNHEALTHY) " "
+                                              "if the PCIe link of its GPU runs below its maximum "
+                                              "speed or width, or if the probe reaches less than "
+                                              "<pct> percent of the link bandwidth. [default pct: "
+                                              STR(HEALTH_MIN_DEFAULT) "]"},
+    {"sysfs-root", OPT_SYSFS_ROOT, "<dir>",   0,  "Read PCIe links from <dir> instead of /sys (fixture "
+                                                  "trees)."},
+    {"processes",   OPT_PROCESSES, 0,         0,  "First run the transfers with one process per GPU "
+                                                  "(transfers grouped by destination GPU), started "
+                                                  "together on a shared-memory barrier, then in this "
+                                                  "process, and compare both. Other outputs use the "
+                                                  "single-process results."},
+    {"baseline",     OPT_BASELINE, "<file>",  0,  "Compare results with a file written by --output and "
+                                                  "exit with status " STR(EXIT_REGRESSION) " if a "
+                                                  "transfer is slower than the tolerance allows."},
+    {"tolerance",   OPT_TOLERANCE, "<pct>",   0,  "Specify the accepted bandwidth drop against the "
+                                                  "baseline in percent. [default: "
+                                                  STR(TOLERANCE_DEFAULT) "]"},
+    {"alloc-bench", OPT_ALLOC_BENCH, 0,      0,  "Instead of running the transfers, time pinned, "
+                                                  "registered, NUMA and device allocations (and "
+                                                  "frees) from 4KiB up to the transfer size on their "
+                                                  "GPUs and on each NUMA node, with up to <iter> "
+                                                  "allocations of each size."},
+    {"daemon",         OPT_DAEMON, "<socket>", 0, "Keep buffers, streams and events alive and run the "
+                                                  "transfers on each \"probe [iter=<nb>] "
+                                                  "[size=<bytes>]\" request received on the <socket> "
+                                                  "UNIX socket. Results are sent back as JSON."},
+    {"verify",         OPT_VERIFY, "<seed>",  OPTION_ARG_OPTIONAL,
+                                              "Fill sources with a seeded pattern and checksum "
+                                              "destinations after each iteration of a separate "
+                                              "untimed pass. [default seed: "
+                                              STR(VERIFY_SEED_DEFAULT) "]"},
+    {"dram-counters", OPT_DRAM_COUNTERS, 0,   0,  "Count bytes read and written by the DRAM of each "
+                                                  "socket during each run with uncore memory "
+                                                  "controller counters (perf_event, may require "
+                                                  "perf_event_paranoid <= 0)."},
     {0}
 };
 
+/**
+ * Parse a size in bytes, with an optional binary unit suffix (K, M, G or T,
+ * optionally followed by B or iB)
+ *
+ * @param   arg[in]       String to parse
+ * @param   n_bytes[out]  Parsed size
+ * @return  0 on success, -1 if the string is not a size above 0
+ */
+static int parse_size(const char *arg, size_t *n_bytes)
+{
+    const char *units = "KMGT";
+    const char *unit;
+    char *endptr;
+    int shift = 0;
+
+    errno = 0;
+    const unsigned long long n = strtoull(arg, &endptr, 10);
+    if (errno != 0 || endptr == arg || arg[0] == '-' || n == 0)
+        return -1;
+
+    if (*endptr != '\0' && (unit = strchr(units, toupper(*endptr))) != NULL)
+    {
+        shift = 10 * (unit - units + 1);
+        endptr++;
+        if (strcmp(endptr, "iB") == 0)
+            endptr += 2;
+    }
+
+    if (strcmp(endptr, "B") == 0)
+        endptr++;
+
+    if (*endptr != '\0' || n > (unsigned long long)(LONG_MAX >> shift))
+        return -1;
+
+    *n_bytes = (size_t)n << shift;
+    return 0;
+}
+
 /* Parse a single option */
 static error_t parse_opt(int key, char *arg, struct argp_state *state)
 {
-    Hits_t *hits = (Hits_t *)state->input;
-    Transfer_t *transfer = &hits->transfer[hits->n_transfers];
+    Cli_t *cli = (Cli_t *)state->input;
+    Hits_t *hits = &cli->hits;
 
     const char* token;
     char *endptr;
+    int p, device, device2;
+    size_t n_bytes;
 
     switch (key)
     {
         case 'd':
-            transfer->type = DTOH;
-            transfer->device = strtol(arg, &endptr, 10);
-            if (errno == EINVAL || errno == ERANGE || transfer->device < 0)
+            device = strtol(arg, &endptr, 10);
+            if (errno == EINVAL || errno == ERANGE || device < 0)
             {
                 fprintf(stderr, "Error: cannot parse the GPU id from the --dtoh argument. "
                                 "Exit.\n");
                 exit(1);
             }
 
-            transfer->device2 = -1;
-            hits->n_transfers++;
+            if (hits_plan_add(hits, DTOH, device, -1) < 0)
+                exit(1);
             break;
         case 'h':
-            transfer->type = HTOD;
-            transfer->device = strtol(arg, &endptr, 10);
-            if (errno == EINVAL || errno == ERANGE || transfer->device < 0)
+            device = strtol(arg, &endptr, 10);
+            if (errno == EINVAL || errno == ERANGE || device < 0)
             {
                 fprintf(stderr, "Error: cannot parse the GPU id from th --htod argument. "
                                 "Exit.\n");
                 exit(1);
             }
 
-            transfer->device2 = -1;
-            hits->n_transfers++;
+            if (hits_plan_add(hits, HTOD, device, -1) < 0)
+                exit(1);
+            break;
+        case 'u':
+            device = strtol(arg, &endptr, 10);
+            if (errno == EINVAL || errno == ERANGE || device < 0)
+            {
+                fprintf(stderr, "Error: cannot parse the GPU id from the --managed argument. "
+                                "Exit.\n");
+                exit(1);
+            }
+
+            if (hits_plan_add(hits, MANAGED, device, -1) < 0)
+                exit(1);
+            break;
+        case OPT_DEMAND_FAULT:
+            hits->is_demand_fault = true;
             break;
         case 'i':
+            cli->is_iter_set = true;
             hits->n_iter = strtol(arg, &endptr, 10);
             if (errno == EINVAL || errno == ERANGE || hits->n_iter < 0)
             {
@@ -158,19 +332,154 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
                 exit(1);
             }
             break;
+        case OPT_HEALTHCHECK:
+            cli->is_healthcheck = true;
+            if (arg == NULL)
+                break;
+
+            hits->health_min = strtod(arg, &endptr);
+            if (errno == ERANGE || arg == endptr || hits->health_min < 0)
+            {
+                fprintf(stderr, "Error: cannot parse the percentage from the --healthcheck "
+                                "argument. Exit.\n");
+                exit(1);
+            }
+            break;
+        case OPT_PROCESSES:
+            cli->is_processes = true;
+            break;
+        case OPT_SYSFS_ROOT:
+            hits->sysfs_root = arg;
+            break;
+        case OPT_PROMETHEUS:
+            cli->prometheus = arg;
+            break;
+        case OPT_INTERVAL:
+            cli->interval = strtol(arg, &endptr, 10);
+            if (errno == EINVAL || errno == ERANGE || arg == endptr || cli->interval <= 0)
+            {
+                fprintf(stderr, "Error: cannot parse the amount of seconds from the --interval "
+                                "argument. Exit.\n");
+                exit(1);
+            }
+            break;
+        case OPT_TRACE:
+            hits->is_trace = true;
+            cli->trace = arg;
+            break;
+        case OPT_DRAM_COUNTERS:
+            hits->is_dram_counters = true;
+            break;
+        case OPT_WAIT:
+            for (p = 0; p < WAIT_COUNT; p++)
+                if (strcmp(arg, wait_str[p]) == 0)
+                    break;
+
+            if (p == WAIT_COUNT)
+            {
+                fprintf(stderr, "Error: --wait argument only accepts auto, spin, yield, blocking "
+                                "or callback. Exit.\n");
+                exit(1);
+            }
+
+            hits->wait = (Wait_t)p;
+            break;
+        case OPT_PRIORITY:
+            for (p = 0; p < PRIORITY_COUNT; p++)
+                if (strcmp(arg, priority_str[p]) == 0)
+                    break;
+
+            if (p == PRIORITY_COUNT)
+            {
+                fprintf(stderr, "Error: --priority argument only accepts high, normal or low. "
+                                "Exit.\n");
+                exit(1);
+            }
+
+            hits->priority = (Priority_t)p;
+            break;
+        case OPT_QOS_PROBE:
+            hits->qos.device = strtol(arg, &endptr, 10);
+            if (errno == EINVAL || errno == ERANGE || arg == endptr || hits->qos.device < 0)
+            {
+                fprintf(stderr, "Error: cannot parse the GPU id from the --qos-probe argument. "
+                                "Exit.\n");
+                exit(1);
+            }
+            break;
+        case OPT_QOS_SIZE:
+            if (parse_size(arg, &hits->qos.n_bytes) != 0)
+            {
+                fprintf(stderr, "Error: cannot parse the probe size from the --qos-size argument. "
+                                "Exit.\n");
+                exit(1);
+            }
+            break;
+        case 'z':
+            hits->engines[0] = ENGINE_AUTO;
+            hits->engines[1] = ENGINE_KERNEL;
+            hits->n_engines  = 2;
+            break;
+        case OPT_ENGINE:
+            hits->n_engines = 0;
+            for (token = strtok(arg, ","); token != NULL; token = strtok(NULL, ","))
+            {
+                int e;
+                for (e = 0; e < ENGINE_COUNT; e++)
+                    if (strcmp(token, engine_str[e]) == 0)
+                        break;
+
+                for (int k = 0; k < hits->n_engines && e < ENGINE_COUNT; k++)
+                    if (hits->engines[k] == (Engine_t)e)
+                        e = ENGINE_COUNT;
+
+                if (e == ENGINE_COUNT)
+                {
+                    fprintf(stderr, "Error: --engine argument only accepts a list of distinct "
+                                    "engines among auto, sdma, blit and kernel. Exit.\n");
+                    exit(1);
+                }
+
+                hits->engines[hits->n_engines++] = (Engine_t)e;
+            }
+
+            if (hits->n_engines == 0)
+            {
+                fprintf(stderr, "Error: --engine argument requires at least one engine. Exit.\n");
+                exit(1);
+            }
+            break;
         case 'n':
             hits->alloc_flags = hits->alloc_flags & ~is_numa_aware;
             break;
         case 'm':
             hits->alloc_flags = hits->alloc_flags & ~is_pinned;
             break;
+        case OPT_PAGEABLE:
+            hits->alloc_flags = hits->alloc_flags & ~is_pinned;
+            for (token = strtok(arg, ","); token != NULL; token = strtok(NULL, ","))
+            {
+                if (strcmp(token, "populate") == 0)
+                    hits->alloc_flags |= is_populate;
+                else if (strcmp(token, "hugepage") == 0)
+                    hits->alloc_flags |= is_hugepage;
+                else if (strcmp(token, "nohugepage") == 0)
+                    hits->alloc_flags |= is_nohugepage;
+                else if (strcmp(token, "touch") == 0)
+                    hits->alloc_flags |= is_first_touch;
+                else
+                {
+                    fprintf(stderr, "Error: --pageable argument only accepts populate, hugepage, "
+                                    "nohugepage and touch. Exit.\n");
+                    exit(1);
+                }
+            }
+            break;
         case 'p':
-            transfer->type = DTOD;
-
             /* Parse first GPU id */
             token = strtok(arg, ",");
-            transfer->device = (token != NULL ) ? strtol(token, &endptr, 10) : -1;
-            if (errno == EINVAL || errno == ERANGE || token == endptr || transfer->device < 0)
+            device = (token != NULL ) ? strtol(token, &endptr, 10) : -1;
+            if (errno == EINVAL || errno == ERANGE || token == endptr || device < 0)
             {
                 fprintf(stderr, "Error: cannot parse first GPU id from --dtod argument. "
                                 "This argument only accepts a list of two ids separated "
@@ -180,8 +489,8 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 
             /* Parse second GPU id */
             token = strtok(NULL, ",");
-            transfer->device2 = (token != NULL) ? strtol(token, &endptr, 10) : -1;
-            if (errno == EINVAL || errno == ERANGE || token == endptr || transfer->device2 < 0)
+            device2 = (token != NULL) ? strtol(token, &endptr, 10) : -1;
+            if (errno == EINVAL || errno == ERANGE || token == endptr || device2 < 0)
             {
                 fprintf(stderr, "Error: cannot parse second GPU id from --dtod argument. "
                                 "This argument only accepts a list of two ids separated "
@@ -198,26 +507,187 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
                 exit(1);
             }
 
-            hits->n_transfers++;
+            if (hits_plan_add(hits, DTOD, device, device2) < 0)
+                exit(1);
             break;
         case 's':
-            hits->n_size = strtol(arg, &endptr, 10);
-            if (errno == EINVAL || errno == ERANGE || hits->n_iter < 0)
+            if (parse_size(arg, &n_bytes) != 0)
             {
                 fprintf(stderr, "Error: cannot parse the transfer size from the "
                                 "--size argument. Exit.\n");
                 exit(1);
             }
 
-            if (hits->n_size > N_SIZE_MAX)
+            hits->n_size = n_bytes;
+            cli->is_size_set = true;
+            break;
+        case OPT_STRIDED:
+            cli->is_size_set = true;
+            /* Parse row width */
+            token = strtok(arg, ",");
+            if (token == NULL || parse_size(token, &hits->shape.width) != 0)
+            {
+                fprintf(stderr, "Error: cannot parse the row width from the --strided "
+                                "argument. Exit.\n");
+                exit(1);
+            }
+
+            /* Parse amount of rows */
+            token = strtok(NULL, ",");
+            hits->shape.height = (token != NULL) ? strtol(token, &endptr, 10) : 0;
+            if (errno == EINVAL || errno == ERANGE || token == endptr || (long)hits->shape.height <= 0)
             {
-                fprintf(stderr, "Error: maximum transfer size value is %d. Exit.", N_SIZE_MAX);
+                fprintf(stderr, "Error: cannot parse the amount of rows from the --strided "
+                                "argument. Exit.\n");
+                exit(1);
+            }
+
+            /* Parse optional amount of slices */
+            token = strtok(NULL, ",");
+            hits->shape.depth = (token != NULL) ? strtol(token, &endptr, 10) : 1;
+            if (errno == EINVAL || errno == ERANGE || token == endptr || (long)hits->shape.depth <= 0)
+            {
+                fprintf(stderr, "Error: cannot parse the amount of slices from the --strided "
+                                "argument. Exit.\n");
+                exit(1);
+            }
+
+            if (strtok(NULL, ",") != NULL)
+            {
+                fprintf(stderr, "Error: --strided argument only accepts a width, a height and "
+                                "an optional depth separated by commas. Exit.\n");
+                exit(1);
+            }
+            break;
+        case OPT_PITCH:
+            if (parse_size(arg, &hits->shape.pitch) != 0)
+            {
+                fprintf(stderr, "Error: cannot parse the row pitch from the --pitch argument. "
+                                "Exit.\n");
+                exit(1);
+            }
+            break;
+        case 'o':
+            cli->output = arg;
+            break;
+        case OPT_BASELINE:
+            cli->baseline = arg;
+            break;
+        case OPT_DAEMON:
+            cli->socket = arg;
+            break;
+        case OPT_WORKING_SET:
+            if (parse_size(arg, &hits->working_set) != 0)
+            {
+                fprintf(stderr, "Error: cannot parse the size from the --working-set argument. "
+                                "Exit.\n");
+                exit(1);
+            }
+            break;
+        case OPT_OFFSET_SWEEP:
+            {
+                /* Static storage, tokens point into the default list */
+                static char offsets_default[] = OFFSETS_DEFAULT;
+
+                hits->n_offsets = 0;
+                for (token = strtok((arg != NULL) ? arg : offsets_default, ",");
+                     token != NULL; token = strtok(NULL, ","))
+                {
+                    errno = 0;
+                    const unsigned long long offset = strtoull(token, &endptr, 10);
+                    if (errno != 0 || endptr == token || *endptr != '\0' || token[0] == '-' ||
+                        hits->n_offsets == OFFSETS_MAX)
+                    {
+                        fprintf(stderr, "Error: --offset-sweep argument only accepts up to %d "
+                                        "comma-separated byte offsets. Exit.\n", OFFSETS_MAX);
+                        exit(1);
+                    }
+
+                    hits->offsets[hits->n_offsets++] = offset;
+                }
+
+                if (hits->n_offsets == 0)
+                {
+                    fprintf(stderr, "Error: --offset-sweep argument requires at least one "
+                                    "offset. Exit.\n");
+                    exit(1);
+                }
+            }
+            break;
+        case OPT_ALLOC_BENCH:
+            cli->is_alloc_bench = true;
+            break;
+        case OPT_TOLERANCE:
+            cli->tolerance = strtod(arg, &endptr);
+            if (errno == ERANGE || arg == endptr || cli->tolerance < 0)
+            {
+                fprintf(stderr, "Error: cannot parse the percentage from the --tolerance "
+                                "argument. Exit.\n");
+                exit(1);
+            }
+            break;
+        case OPT_VERIFY:
+            hits->is_verify = true;
+            if (arg == NULL)
+                break;
+
+            hits->seed = strtoull(arg, &endptr, 0);
+            if (errno == EINVAL || errno == ERANGE || arg == endptr)
+            {
+                fprintf(stderr, "Error: cannot parse the seed from the --verify argument. "
+                                "Exit.\n");
                 exit(1);
             }
             break;
         case ARGP_KEY_END:
             if (hits->n_transfers == 0)
                 argp_usage(state);
+
+            if (cli->socket != NULL && (cli->output != NULL || cli->baseline != NULL))
+            {
+                fprintf(stderr, "Error: --output and --baseline do not apply to the daemon "
+                                "mode. Exit.\n");
+                exit(1);
+            }
+
+            if (cli->prometheus != NULL && (cli->socket != NULL || hits->n_offsets > 0))
+            {
+                fprintf(stderr, "Error: --prometheus cannot be combined with --daemon or "
+                                "--offset-sweep. Exit.\n");
+                exit(1);
+            }
+
+            if (cli->is_processes && (cli->socket != NULL || cli->prometheus != NULL ||
+                                      cli->is_healthcheck || cli->is_alloc_bench ||
+                                      hits->n_offsets > 0 || cli->trace != NULL))
+            {
+                fprintf(stderr, "Error: --processes only applies to single runs. Exit.\n");
+                exit(1);
+            }
+
+            /* HSA_ENABLE_SDMA is read once per process, single runs compare its values */
+            for (int e = 0; e < hits->n_engines && hits->n_engines > 1; e++)
+                if (hits->engines[e] == ENGINE_SDMA || hits->engines[e] == ENGINE_BLIT)
+                    cli->is_engine_processes = (cli->socket == NULL && cli->prometheus == NULL &&
+                                                !cli->is_healthcheck && !cli->is_alloc_bench &&
+                                                hits->n_offsets == 0);
+
+            if (cli->is_engine_processes && (cli->is_processes || cli->trace != NULL))
+            {
+                fprintf(stderr, "Error: --processes and --trace cannot be combined with the sdma "
+                                "and blit engines along with other engines. Exit.\n");
+                exit(1);
+            }
+
+            /* Probes must stay short enough to run on production nodes */
+            if (cli->prometheus != NULL || cli->is_healthcheck)
+            {
+                hits->is_trace = hits->is_trace || (cli->prometheus != NULL);
+                if (!cli->is_size_set)
+                    hits->n_size = PROBE_SIZE_DEFAULT;
+                if (!cli->is_iter_set)
+                    hits->n_iter = PROBE_ITER_DEFAULT;
+            }
             break;
         default:
             return ARGP_ERR_UNKNOWN;
@@ -229,336 +699,702 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 /* Argp parser */
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
-static void _transfer_init_common(Transfer_t *t)
+
+static void stop_daemon(int sig)
 {
-    t->numa_node  = -1;
-    t->is_started = false;
+    (void)sig;
+    is_stopping = 1;
+}
 
-    checkHip( hipGetDeviceProperties(&t->prop_device, t->device) );
-    if (t->device2 >= 0)
-        checkHip( hipGetDeviceProperties(&t->prop_device2, t->device2) );
+/**
+ * Run the transfers for one client request and reply with the results.
+ * Requests are single lines: "probe" with optional iter=<nb> and
+ * size=<bytes> settings (valid for this request only), or "quit".
+ *
+ * @param   cli[inout]  Command line settings
+ * @param   in[in]      Client connection, read side
+ * @param   out[in]     Client connection, write side
+ * @return  True if the daemon must stop
+ */
+static bool serve_request(Cli_t *cli, FILE *in, FILE *out)
+{
+    char line[DAEMON_REQUEST_MAX];
+    const long n_iter = cli->hits.n_iter;
+    const long n_size = cli->hits.n_size;
+    const char *error = NULL;
+    char *token, *endptr;
+
+    if (fgets(line, sizeof(line), in) == NULL)
+        return false;
 
-    checkHip( hipSetDevice(t->device) );
+    token = strtok(line, " \t\r\n");
+    if (token != NULL && strcmp(token, "quit") == 0)
+    {
+        fprintf(out, "{\"status\":\"stopping\"}\n");
+        return true;
+    }
 
-    checkHip( hipEventCreate(&t->start) );
-    checkHip( hipEventCreate(&t->stop) );
+    if (token == NULL || strcmp(token, "probe") != 0)
+        error = "unknown request, expected probe or quit";
 
-    checkHip( hipStreamCreateWithFlags(&t->stream, hipStreamNonBlocking) );
+    while (error == NULL && (token = strtok(NULL, " \t\r\n")) != NULL)
+    {
+        errno = 0;
+        if (strncmp(token, "iter=", 5) == 0)
+        {
+            cli->hits.n_iter = strtol(token + 5, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || endptr == token + 5 || cli->hits.n_iter <= 0)
+                error = "cannot parse the amount of iterations";
+        }
+        else if (strncmp(token, "size=", 5) == 0 && cli->hits.shape.height == 0)
+        {
+            size_t n_bytes;
+            if (parse_size(token + 5, &n_bytes) != 0 || n_bytes > (size_t)n_size)
+                error = "cannot parse the transfer size or larger than the allocated buffers";
+            else
+                cli->hits.n_size = n_bytes;
+        }
+        else
+            error = "unknown setting, expected iter=<nb> or size=<bytes> (not strided)";
+    }
+
+    if (error == NULL && hits_run(&cli->hits) != 0)
+        error = "transfers failed, see the daemon log";
+
+    if (error != NULL)
+        fprintf(out, "{\"error\":\"%s\"}\n", error);
+    else
+        hits_print_json(&cli->hits, out);
+
+    cli->hits.n_iter = n_iter;
+    cli->hits.n_size = n_size;
+    return false;
 }
 
 /**
- * Set NUMA affinity based on GPU property.
+ * Serve probe requests on a UNIX socket until "quit", SIGINT or SIGTERM.
+ * Buffers, streams and events are allocated once, before listening.
  *
- * @param   t[in]  transfer structure
+ * @param   cli[inout]  Command line settings, with a plan already set up
  */
-void set_numa_affinity(Transfer_t *t)
+static void serve(Cli_t *cli)
 {
-    char numa_file[PATH_MAX];
-    struct hipDeviceProp_t *prop = &t->prop_device;
-    sprintf(numa_file, "/sys/class/pci_bus/%04x:%02x/device/numa_node",
-                       prop->pciDomainID, prop->pciBusID);
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct stat st;
+    bool is_quit = false;
 
-    FILE* file = fopen(numa_file, "r");
-    if (file == NULL)
-        return;
+    if (strlen(cli->socket) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: socket path %s is too long. Exit.\n", cli->socket);
+        exit(1);
+    }
 
-    int ret = fscanf(file, "%d", &t->numa_node);
-    fclose(file);
+    /* Only replace a socket left by a previous daemon */
+    if (stat(cli->socket, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(cli->socket);
 
-    if (ret == 1)
-        numa_set_preferred(t->numa_node);
-}
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, cli->socket);
 
-void dtoh_transfer_init(Transfer_t *t, const size_t n_bytes, const int alloc_flags)
-{
-    _transfer_init_common(t);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0)
+    {
+        fprintf(stderr, "Error: cannot listen on socket %s (%s). Exit.\n", cli->socket,
+                strerror(errno));
+        exit(1);
+    }
+
+    /* No SA_RESTART so that accept returns on signals */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_daemon;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
 
-    if (alloc_flags & is_numa_aware)
-        set_numa_affinity(t);
+    printf("Listening on %s\n", cli->socket);
+    fflush(stdout);
+    cli->hits.is_verbose = false;
 
-    if (alloc_flags & is_pinned)
+    while (!is_stopping && !is_quit)
     {
-        checkHip( hipHostMalloc(((void **)&t->dest), n_bytes, hipHostMallocDefault | hipHostMallocNumaUser) );
-    }
-    else
-        t->dest = (float *)malloc(n_bytes);
+        int client = accept(fd, NULL, NULL);
+        if (client < 0)
+            continue;
+
+        /* A silent client must not hold the daemon */
+        struct timeval timeout = { DAEMON_TIMEOUT, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        FILE *in = fdopen(client, "r");
+        FILE *out = fdopen(dup(client), "w");
+        if (in == NULL || out == NULL)
+        {
+            fprintf(stderr, "Warning: cannot open client connection (%s).\n", strerror(errno));
+            if (in != NULL)
+                fclose(in);
+            else
+                close(client);
+            if (out != NULL)
+                fclose(out);
+            continue;
+        }
 
-    assert(t->dest != NULL);
+        is_quit = serve_request(cli, in, out);
+        fclose(out);
+        fclose(in);
+    }
 
-    checkHip( hipMalloc(((void **)&t->src), n_bytes) );
+    close(fd);
+    unlink(cli->socket);
 }
 
-void htod_transfer_init(Transfer_t *t, const size_t n_bytes, const int alloc_flags)
+/**
+ * Probe the transfers periodically and write metrics after each probe,
+ * until SIGINT or SIGTERM
+ *
+ * @param   cli[inout]  Command line settings with a plan set up
+ * @return  0 once stopped, an error code if a probe fails
+ */
+static int probe_loop(Cli_t *cli)
 {
-    _transfer_init_common(t);
+    struct sigaction sa;
+    bool is_warned = false;
 
-    if (alloc_flags & is_numa_aware)
-        set_numa_affinity(t);
+    /* No SA_RESTART so that sleep returns on signals */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_daemon;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
 
-    if (alloc_flags & is_pinned)
+    printf("Probing every %ld seconds into %s\n", cli->interval, cli->prometheus);
+    fflush(stdout);
+    cli->hits.is_verbose = false;
+
+    while (!is_stopping)
     {
-        checkHip( hipHostMalloc(((void **)&t->src), n_bytes, hipHostMallocDefault | hipHostMallocNumaUser) );
-    }
-    else
-        t->src = (float *)malloc(n_bytes);
+        struct timeval start, end;
 
-    assert(t->src != NULL);
+        gettimeofday(&start, NULL);
+        int ret = hits_run(&cli->hits);
+        if (ret != 0)
+            return ret;
+        gettimeofday(&end, NULL);
+
+        const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1E6;
+        if (seconds > PROBE_DURATION_MAX && !is_warned)
+        {
+            fprintf(stderr, "Warning: a probe took %.2f seconds, reduce --size or --iter.\n",
+                    seconds);
+            is_warned = true;
+        }
 
-    checkHip( hipMalloc(((void **)&t->dest), n_bytes) );
+        if (hits_write_prometheus(&cli->hits, cli->prometheus) != 0)
+            return 1;
+
+        for (long t = 0; t < cli->interval && !is_stopping; t++)
+            sleep(1);
+    }
+
+    return 0;
 }
 
-void dtod_transfer_init(Transfer_t *t, const size_t n_bytes)
+/**
+ * Run the transfers of a group in a worker process: set up its own plan,
+ * wait for the other workers, run and store results in shared memory.
+ * Never returns.
+ *
+ * @param   cli[inout]     Command line settings (copy of the parent)
+ * @param   shared[inout]  Shared memory of the workers
+ * @param   w[in]          Index of the worker
+ * @param   group[in]      Worker index of each transfer
+ */
+static void worker(Cli_t *cli, Shared_t *shared, const int w, const int *group)
 {
-    _transfer_init_common(t);
+    Hits_t *hits = &cli->hits;
+    const int n_transfers = hits->n_transfers;
+    int *index = (int *)malloc(sizeof(int) * n_transfers);
+    int n = 0;
+    assert(index != NULL);
+
+    /* Keep the transfers of this worker only */
+    for (int i = 0; i < n_transfers; i++)
+        if (group[i] == w)
+        {
+            index[n] = i;
+            hits->transfer[n++] = hits->transfer[i];
+        }
+
+    hits->n_transfers = n;
+    hits->is_verbose  = false;
+    hits->qos.device  = -1;
+
+    /* Failed workers still reach the barrier so that others do not wait forever */
+    int ret = hits_setup(hits);
+    __atomic_store_n(&shared->arrived[w], 1, __ATOMIC_SEQ_CST);
+    pthread_barrier_wait(&shared->barrier);
+    if (ret == 0)
+        ret = hits_run(hits);
 
-    /* Ensure peer-to-peer access is possible between the two GPUs */
-    int is_access = 0;
-    hipDeviceCanAccessPeer(&is_access, t->device, t->device2);
-    if (!is_access)
+    if (ret == 0)
     {
-        fprintf(stderr, "Error: P2P cannot be enabled between devices %d and %d\n",
-                t->device, t->device2);
-        exit(1);
+        Result_t *results = (Result_t *)malloc(sizeof(Result_t) * hits->n_engines * n);
+        assert(results != NULL);
+
+        hits_get_results(hits, results, hits->n_engines * n);
+        for (int e = 0; e < hits->n_engines; e++)
+            for (int j = 0; j < n; j++)
+                shared->results[e * n_transfers + index[j]] = results[e * n + j];
+
+        free(results);
     }
 
-    checkHip( hipSetDevice(t->device) );
-    checkHip( hipMalloc((void **)&t->dest, n_bytes) );
-    checkHip( hipDeviceEnablePeerAccess(t->device2, 0) );
+    const int ret_fini = hits_fini(hits);
+    if (ret == 0)
+        ret = ret_fini;
 
-    checkHip( hipSetDevice(t->device2) );
-    checkHip( hipMalloc((void **)&t->src, n_bytes) );
+    shared->ret[w] = ret;
+    free(index);
+    _exit(ret);
 }
 
 /**
- * Initialize all transfers
+ * Kill the workers still running and reap them
  *
- * @param   hits[inout]  Main application structure
+ * @param   shared[inout]   Shared memory of the workers
+ * @param   pids[in]        Process ids of the workers
+ * @param   is_done[inout]  Workers already reaped
+ * @param   n_workers[in]   Amount of workers
  */
-void transfer_init(Hits_t *hits)
+static void kill_workers(Shared_t *shared, const pid_t *pids, bool *is_done, const int n_workers)
 {
-    /* Initialize all streams and buffers */
-    for (int i = 0; i < hits->n_transfers; i++)
-    {
-        Transfer_t *t = &hits->transfer[i];
-
-        switch(t->type)
+    for (int w = 0; w < n_workers; w++)
+        if (!is_done[w])
         {
-            case DTOH:
-                dtoh_transfer_init(t, hits->n_size, hits->alloc_flags);
-                break;
-            case HTOD:
-                htod_transfer_init(t, hits->n_size, hits->alloc_flags);
-                break;
-            case DTOD:
-                dtod_transfer_init(t, hits->n_size);
-                break;
+            kill(pids[w], SIGKILL);
+            waitpid(pids[w], NULL, 0);
+            shared->ret[w] = 1;
+            is_done[w] = true;
         }
-    }
 }
 
 /**
- * Initialize the application
+ * Wait for all workers. A worker dying before the start barrier, or workers
+ * not all reaching it in time, would leave the others waiting forever: the
+ * remaining workers are then killed.
  *
- * @param   argc[in]    Amount of arguments
- * @param   argv[in]    Array of arguments
- * @param   hits[out]   Main application structure
+ * @param   shared[inout]   Shared memory of the workers
+ * @param   pids[in]        Process ids of the workers
+ * @param   n_workers[in]   Amount of workers
+ * @param   names[in]       Name of each worker in messages
+ * @return  0 on success, the status of the first failed worker otherwise
  */
-void init(int argc, char *argv[], Hits_t *hits)
+static int wait_workers(Shared_t *shared, const pid_t *pids, const int n_workers,
+                        const char (*names)[WORKER_NAME_MAX])
 {
-    hits->transfer = (Transfer_t *)malloc(sizeof(Transfer_t) * (argc - 1));
-    if (hits->transfer == NULL)
+    const time_t t_start = time(NULL);
+    bool is_done[WORKERS_MAX];
+    int n_running = n_workers, ret = 0;
+
+    for (int w = 0; w < n_workers; w++)
+        is_done[w] = false;
+
+    while (n_running > 0)
     {
-         fprintf(stderr,"Error: Cannot allocate main data structure. Exit.\n");
-         exit(1);
-    }
+        for (int w = 0; w < n_workers; w++)
+        {
+            int status;
+            if (is_done[w] || waitpid(pids[w], &status, WNOHANG) != pids[w])
+                continue;
+
+            is_done[w] = true;
+            n_running--;
+
+            if (WIFSIGNALED(status))
+            {
+                fprintf(stderr, "Error: worker of %s killed by signal %d.\n", names[w],
+                        WTERMSIG(status));
+                shared->ret[w] = 1;
+            }
+            else if (WEXITSTATUS(status) != 0 && shared->ret[w] == 0)
+                shared->ret[w] = WEXITSTATUS(status);
 
-    /* Set defaults */
-    hits->n_transfers   = 0;
-    hits->n_iter        = N_ITER_DEFAULT;
-    hits->n_size        = N_SIZE_DEFAULT;
-    hits->alloc_flags   = is_numa_aware | is_pinned;
+            if (shared->ret[w] != 0 && ret == 0)
+            {
+                fprintf(stderr, "Error: worker of %s failed.\n", names[w]);
+                ret = shared->ret[w];
+            }
+        }
 
-    argp_parse(&argp, argc, argv, 0, 0, hits);
+        if (n_running == 0)
+            break;
 
-    transfer_init(hits);
+        int n_arrived = 0;
+        bool is_lost = false;
+        for (int w = 0; w < n_workers; w++)
+        {
+            const int is_arrived = __atomic_load_n(&shared->arrived[w], __ATOMIC_SEQ_CST);
+            n_arrived += is_arrived;
+            is_lost |= (is_done[w] && !is_arrived);
+        }
+
+        if (is_lost && n_arrived < n_workers)
+        {
+            fprintf(stderr, "Error: a worker exited before the start barrier, stopping the "
+                            "others.\n");
+            kill_workers(shared, pids, is_done, n_workers);
+            return (ret != 0) ? ret : 1;
+        }
+
+        if (n_arrived < n_workers && time(NULL) - t_start > WORKERS_START_TIMEOUT)
+        {
+            fprintf(stderr, "Error: %d of %d workers reached the start barrier within %d "
+                            "seconds, stopping them.\n", n_arrived, n_workers,
+                    WORKERS_START_TIMEOUT);
+            kill_workers(shared, pids, is_done, n_workers);
+            return 1;
+        }
+
+        usleep(WORKERS_POLL_USEC);
+    }
+
+    return ret;
 }
 
 /**
- * Cleanup the application
+ * Fork workers running groups of transfers, wait for them and gather their
+ * results. Workers are forked before this process initializes the HIP runtime.
  *
- * @param   hits[inout]  Main application structure
+ * @param   cli[inout]     Command line settings (plan not set up)
+ * @param   group[in]      Worker index of each transfer
+ * @param   names[in]      Name of each worker in messages
+ * @param   n_workers[in]  Amount of workers
+ * @param   engine[in]     Index of the only compared engine run by workers, -1 for all
+ * @param   results[out]   Results of all transfers, ordered as by hits_get_results
+ * @return  0 on success, the status of the first failed worker otherwise
  */
-void fini(Hits_t *hits)
+static int run_workers(Cli_t *cli, const int *group, const char (*names)[WORKER_NAME_MAX],
+                       const int n_workers, const int engine, Result_t *results)
 {
-    /* Free host buffers */
-    for (int i = 0; i < hits->n_transfers; i++)
+    Hits_t *hits = &cli->hits;
+    const int n_results = ((engine >= 0) ? 1 : hits->n_engines) * hits->n_transfers;
+    const size_t n_shared = sizeof(Shared_t) + sizeof(Result_t) * n_results;
+    pthread_barrierattr_t attr;
+    pid_t pids[WORKERS_MAX];
+
+    Shared_t *shared = (Shared_t *)mmap(NULL, n_shared, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
     {
-        Transfer_t *t = &hits->transfer[i];
+        fprintf(stderr, "Error: cannot map memory shared with workers (%s). Exit.\n",
+                strerror(errno));
+        exit(1);
+    }
 
-        switch(t->type)
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&shared->barrier, &attr, n_workers);
+    pthread_barrierattr_destroy(&attr);
+    fflush(stdout);
+
+    for (int w = 0; w < n_workers; w++)
+    {
+        pids[w] = fork();
+        if (pids[w] < 0)
         {
-            case DTOH:
-                if (hits->alloc_flags & is_pinned)
-                {
-                    checkHip( hipHostFree(t->dest) );
-                }
-                else
-                    free(t->dest);
-                break;
-            case HTOD:
-                if (hits->alloc_flags & is_pinned)
-                {
-                    checkHip( hipHostFree(t->src) );
-                }
-                else
-                    free(t->src);
-                break;
-            case DTOD:
-                break;
+            fprintf(stderr, "Error: cannot fork worker %d (%s). Exit.\n", w, strerror(errno));
+            exit(1);
+        }
+
+        if (pids[w] == 0)
+        {
+            /* Read by the runtime of the worker when it initializes */
+            if (engine >= 0)
+            {
+                hits->engines[0] = hits->engines[engine];
+                hits->n_engines  = 1;
+                setenv("HSA_ENABLE_SDMA", (hits->engines[0] == ENGINE_SDMA) ? "1" : "0", 1);
+            }
+
+            worker(cli, shared, w, group);
         }
     }
 
-    free(hits->transfer);
+    const int ret = wait_workers(shared, pids, n_workers, names);
+    memcpy(results, shared->results, sizeof(Result_t) * n_results);
+
+    /* Destroying a barrier that killed workers still wait on would block */
+    bool is_arrived = true;
+    for (int w = 0; w < n_workers; w++)
+        is_arrived &= (shared->arrived[w] != 0);
+
+    if (is_arrived)
+        pthread_barrier_destroy(&shared->barrier);
+    munmap(shared, n_shared);
+
+    return ret;
 }
 
 /**
- * Launch a direct transfer stream (Host to Device or Device to Host)
+ * Run the transfers with one worker process per GPU
  *
- * @param   t[inout]     Transfe data
- * @param   n_bytes[in]  Transfer size
- * @param   n_iter[in]   Iterations
+ * @param   cli[in]        Command line settings (plan not set up)
+ * @param   results[out]   Results of all transfers (to free), ordered as by
+ *                         hits_get_results
+ * @return  0 on success, the status of the first failed worker otherwise
  */
-void direct_transfer(Transfer_t *t, const size_t n_bytes, const bool is_last_iter)
+static int run_processes(Cli_t *cli, Result_t **results)
 {
-    checkHip( hipSetDevice(t->device) );
+    const Hits_t *hits = &cli->hits;
+    int *group = (int *)malloc(sizeof(int) * hits->n_transfers);
+    char names[WORKERS_MAX][WORKER_NAME_MAX];
+    int devices[WORKERS_MAX], n_workers = 0;
+    assert(group != NULL);
 
-    if (!t->is_started)
+    /* One worker per destination GPU */
+    for (int i = 0; i < hits->n_transfers; i++)
     {
-        printf("Launching %s transfers with Device %d (%x:%02x)",
-               ttype_str[t->type], t->device, t->prop_device.pciDomainID, t->prop_device.pciBusID);
-
-        if (t->numa_node >= 0)
-            printf(" - Host buffer allocated on NUMA node %d", t->numa_node);
+        int w = 0;
+        while (w < n_workers && devices[w] != hits->transfer[i].device)
+            w++;
 
-        printf("\n");
+        if (w == WORKERS_MAX)
+        {
+            fprintf(stderr, "Error: --processes supports up to %d GPUs. Exit.\n", WORKERS_MAX);
+            exit(1);
+        }
 
-        checkHip( hipEventRecord(t->start, t->stream) );
-        t->is_started = true;
+        if (w == n_workers)
+        {
+            devices[n_workers] = hits->transfer[i].device;
+            snprintf(names[n_workers++], WORKER_NAME_MAX, "Device %d", hits->transfer[i].device);
+        }
+        group[i] = w;
     }
 
-    checkHip( hipMemcpyAsync(t->dest, t->src, n_bytes, (t->type == DTOH) ?
-                               hipMemcpyDeviceToHost : hipMemcpyHostToDevice, t->stream) );
+    *results = (Result_t *)malloc(sizeof(Result_t) * hits->n_engines * hits->n_transfers);
+    assert(*results != NULL);
+
+    printf("Running transfers with %d processes\n", n_workers);
 
-    if (is_last_iter)
-        checkHip( hipEventRecord(t->stop, t->stream) );
+    const int ret = run_workers(cli, group, names, n_workers, -1, *results);
+    free(group);
+
+    return ret;
 }
 
 /**
- * Launch a peer-to-peer transfer stream
+ * Run the sdma and blit engines in one worker process each, one after the
+ * other: the runtime reads HSA_ENABLE_SDMA once per process. They are then
+ * flagged as imported in the plan of this process.
  *
- * @param   t[inout]     Transfe data
- * @param   n_bytes[in]  Transfer size
- * @param   n_iter[in]   Iterations
+ * @param   cli[inout]     Command line settings (plan not set up)
+ * @param   results[out]   Results of all transfers and compared engines (to free),
+ *                         ordered as by hits_get_results, only set for imported engines
+ * @return  0 on success, the status of the failed worker otherwise
  */
-void dtod_transfer(Transfer_t *t, const size_t n_bytes, const bool is_last_iter)
+static int run_engine_processes(Cli_t *cli, Result_t **results)
 {
-    checkHip( hipSetDevice(t->device) );
-
-    if (!t->is_started)
+    Hits_t *hits = &cli->hits;
+    const int n = hits->n_transfers;
+    int *group = (int *)calloc(n, sizeof(int));
+    bool is_imported[ENGINE_COUNT] = { false };
+    char names[1][WORKER_NAME_MAX];
+    int ret = 0;
+    assert(group != NULL);
+
+    *results = (Result_t *)malloc(sizeof(Result_t) * hits->n_engines * n);
+    assert(*results != NULL);
+
+    for (int e = 0; e < hits->n_engines && ret == 0; e++)
     {
-        printf("Launching P2P PCIe transfers from Device %d (%x:%02x) to Device %d (%x:%02x)\n",
-               t->device2, t->prop_device2.pciDomainID, t->prop_device2.pciBusID,
-	       t->device, t->prop_device.pciDomainID, t->prop_device.pciBusID);
+        if (hits->engines[e] != ENGINE_SDMA && hits->engines[e] != ENGINE_BLIT)
+            continue;
+
+        snprintf(names[0], WORKER_NAME_MAX, "the %s engine", engine_str[hits->engines[e]]);
+        printf("Running the %s engine in its own process\n", engine_str[hits->engines[e]]);
 
-        checkHip( hipEventRecord(t->start, t->stream) );
-        t->is_started = true;
+        ret = run_workers(cli, group, names, 1, e, *results + e * n);
+        is_imported[e] = (ret == 0);
     }
 
-    checkHip( hipMemcpyPeerAsync(t->dest, t->device, t->src, t->device2, n_bytes, t->stream) );
+    /* Set once all workers are forked, each one runs its engine itself */
+    for (int e = 0; e < hits->n_engines; e++)
+        hits->is_imported[e] = is_imported[e];
 
-    if (is_last_iter)
-        checkHip( hipEventRecord(t->stop, t->stream) );
+    free(group);
+    return ret;
 }
 
 /**
- * Display a dot every second as Heartbeat. Stop when transfers are completed.
+ * Print single-process and multi-process bandwidths side by side
  *
- * @param   arg[in]  Pointer to transfer state
+ * @param   hits[in]        Plan run in this process
+ * @param   processes[in]   Results of the worker processes
  */
-void* heart_beat(void *arg)
+static void print_process_comparison(const Hits_t *hits, const Result_t *processes)
 {
-    bool *is_transfering = (bool*)arg;
-    setbuf(stdout, NULL);
+    const int n_results = hits_get_results(hits, NULL, 0);
+    Result_t *results = (Result_t *)malloc(sizeof(Result_t) * n_results);
+    assert(results != NULL);
 
-    while (*is_transfering)
+    hits_get_results(hits, results, n_results);
+    printf("\nSingle process vs one process per GPU (GB/s):\n");
+
+    for (int k = 0; k < n_results; k++)
     {
-        sleep(1);
-        printf(".");
+        const Result_t *r = &results[k];
+        const int i = k % hits->n_transfers;
+
+        printf("Transfer %d - %s (%s) - Engine: %s:  single %.3f  processes %.3f (%.2fx)\n", i,
+               ttype_str[hits->transfer[i].type], r->bdf, r->engine, r->gbps,
+               processes[k].gbps, processes[k].gbps / r->gbps);
     }
 
-    return NULL;
+    free(results);
 }
 
 int main(int argc, char *argv[])
 {
-    Hits_t hits;
+    Cli_t cli;
+    Result_t *results, *processes = NULL, *engines = NULL;
+    int ret, n_results, n_regressions = 0;
+    long n_corrupted = 0;
+
+    hits_plan_init(&cli.hits);
+    cli.hits.is_verbose = true;
+    cli.output          = NULL;
+    cli.baseline        = NULL;
+    cli.tolerance       = TOLERANCE_DEFAULT;
+    cli.socket          = NULL;
+    cli.is_alloc_bench  = false;
+    cli.trace           = NULL;
+    cli.prometheus      = NULL;
+    cli.interval        = PROBE_INTERVAL_DEFAULT;
+    cli.is_size_set     = false;
+    cli.is_iter_set     = false;
+    cli.is_healthcheck  = false;
+    cli.is_processes    = false;
+    cli.is_engine_processes = false;
+
+    argp_parse(&argp, argc, argv, 0, 0, &cli);
+
+    if (cli.is_alloc_bench)
+    {
+        ret = hits_alloc_bench(&cli.hits);
+        hits_fini(&cli.hits);
+        return ret;
+    }
+
+    /* Workers are forked before the runtime is initialized in this process */
+    if (cli.is_processes)
+    {
+        ret = run_processes(&cli, &processes);
+        if (ret != 0)
+            exit(ret);
+    }
 
-    init(argc, argv, &hits);
-    const int n_transfers = hits.n_transfers;
-    const size_t n_iter = hits.n_iter;
-    const size_t n_bytes = hits.n_size;
-    const float n_gbytes = (float)n_bytes / 1E9;
-    bool is_transfering = true;
-    pthread_t thread;
+    if (cli.is_engine_processes)
+    {
+        ret = run_engine_processes(&cli, &engines);
+        if (ret != 0)
+            exit(ret);
+    }
+
+    ret = hits_setup(&cli.hits);
+    if (ret != 0)
+        exit(ret);
 
-    /* Starting heartbeat thread */
-    pthread_create(&thread, NULL, &heart_beat, &is_transfering);
+    for (int e = 0; e < cli.hits.n_engines && engines != NULL; e++)
+        if (cli.hits.is_imported[e] &&
+            hits_import_results(&cli.hits, e, &engines[e * cli.hits.n_transfers],
+                                cli.hits.n_transfers) != 0)
+            exit(1);
+    free(engines);
 
-    /* Start all transfers at the same time */
-    for (size_t i = 0; i < n_iter; i++)
+    if (cli.hits.n_offsets > 0)
     {
-        const bool is_last = (i == n_iter - 1);
-        for (int j = 0; j < n_transfers; j++)
-        {
-            Transfer_t *t = &hits.transfer[j];
-            (t->type == DTOD) ? dtod_transfer(t, n_bytes, is_last) : direct_transfer(t, n_bytes, is_last);
-        }
+        ret = hits_offset_sweep(&cli.hits);
+        if (ret == 0 && cli.trace != NULL && hits_write_trace(&cli.hits, cli.trace) != 0)
+            ret = 1;
+
+        hits_fini(&cli.hits);
+        hits_pool_release();
+        return ret;
     }
 
-    /* Synchronize the GPU from each transfer */
-    for (int i = 0; i < n_transfers; i++)
+    if (cli.is_healthcheck)
+    {
+        ret = hits_healthcheck(&cli.hits);
+        if (ret == 0 && cli.hits.n_unhealthy > 0)
+            ret = EXIT_UNHEALTHY;
+
+        hits_fini(&cli.hits);
+        hits_pool_release();
+        return ret;
+    }
+
+    if (cli.prometheus != NULL)
     {
-        Transfer_t *t = &hits.transfer[i];
-        checkHip( hipSetDevice(t->device) );
-        checkHip( hipDeviceSynchronize() );
+        ret = probe_loop(&cli);
+        hits_fini(&cli.hits);
+        hits_pool_release();
+        return ret;
     }
 
-    is_transfering = false;
-    printf("\nCompleted.\n");
+    if (cli.socket != NULL)
+    {
+        serve(&cli);
+        hits_fini(&cli.hits);
+        hits_pool_release();
+        return 0;
+    }
 
-    /* Print bandwidth results */
-    for (int i = 0; i < n_transfers; i++)
+    ret = hits_run(&cli.hits);
+    if (ret != 0)
+        exit(ret);
+
+    if (cli.hits.n_engines > 1)
+        hits_print_engine_comparison(&cli.hits);
+
+    if (processes != NULL)
     {
-        float dt_msec, dt_sec;
-        Transfer_t *t = &hits.transfer[i];
-        checkHip( hipSetDevice(t->device) );
-        checkHip( hipEventElapsedTime(&dt_msec, t->start, t->stop) );
-        dt_sec = dt_msec / 1E3;
-
-        if (t->type == DTOD)
-            printf("Transfer %d - P2P transfers from Device %d (%x:%02x) to Device %d (%x:%02x):"
-                   " %.3f GB/s  (%.2f seconds)\n", i, t->device2, t->prop_device2.pciDomainID,
-		   t->prop_device2.pciBusID, t->device, t->prop_device.pciDomainID,
-		   t->prop_device.pciBusID, n_gbytes / dt_sec * n_iter, dt_sec);
-        else
-            printf("Transfer %d - Direct transfers (%s) with Device %d (%x:%02x): "
-                   "%.3f GB/s  (%.2f seconds)\n", i, ttype_str[t->type], t->device,
-		   t->prop_device.pciDomainID, t->prop_device.pciBusID,
-		   n_gbytes / dt_sec * n_iter, dt_sec);
+        print_process_comparison(&cli.hits, processes);
+        free(processes);
     }
 
-    fini(&hits);
+    if (cli.trace != NULL && hits_write_trace(&cli.hits, cli.trace) != 0)
+        exit(1);
 
-    return 0;
-}
+    if (cli.output != NULL && hits_write_results(&cli.hits, cli.output) != 0)
+        exit(1);
+
+    if (cli.baseline != NULL)
+    {
+        n_regressions = hits_check_baseline(&cli.hits, cli.baseline, cli.tolerance);
+        if (n_regressions < 0)
+            exit(1);
+    }
+
+    n_results = hits_get_results(&cli.hits, NULL, 0);
+    results = (Result_t *)malloc(sizeof(Result_t) * n_results);
+    assert(results != NULL);
 
+    hits_get_results(&cli.hits, results, n_results);
+    for (int i = 0; i < n_results; i++)
+        if (results[i].n_corrupted > 0)
+            n_corrupted += results[i].n_corrupted;
+
+    free(results);
+    ret = hits_fini(&cli.hits);
+    hits_pool_release();
+
+    if (ret != 0)
+        return ret;
+
+    if (n_corrupted > 0)
+        return 1;
+
+    return (n_regressions > 0) ? EXIT_REGRESSION : 0;
+}
@@ -0,0 +1,41 @@
+/**
+* HIP Transfer Streams (HIts): Copy kernels used instead of the DMA engines.
+* URL       https://github.com/jyvet/hits
+* License   MIT
+* Author    Jean-Yves VET <contact[at]jean-yves.vet>
+* Copyright (c) 2023
+******************************************************************************/
+
+#ifndef HITS_KERNELS_H
+#define HITS_KERNELS_H
+
+#include <stddef.h>
+#include <hip/hip_runtime.h>
+
+#define COPY_KERNEL_THREADS         256 /* Threads per block                 */
+#define COPY_KERNEL_BLOCKS_PER_CU   4   /* Blocks per compute unit           */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Enqueue a grid-stride copy kernel. Both pointers must be accessible from
+ * the current device (device memory, peer memory or mapped host memory).
+ * 16-byte vector accesses are used when both buffers are aligned.
+ *
+ * @param   dest[out]     Destination buffer
+ * @param   src[in]       Source buffer
+ * @param   n_bytes[in]   Amount of bytes to copy
+ * @param   n_blocks[in]  Amount of blocks in the grid
+ * @param   stream[in]    Stream on which the kernel is enqueued
+ * @return  Launch status
+ */
+hipError_t copy_kernel_launch(void *dest, const void *src, size_t n_bytes, int n_blocks,
+                              hipStream_t stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HITS_KERNELS_H */
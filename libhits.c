@@ -0,0 +1,4194 @@
+/**
+* HIP Transfer Streams (HIts) library: plan transfer streams, run them as many
+*                                      times as needed with the same buffers
+*                                      and fetch structured results.
+* URL       https://github.com/jyvet/hits
+* License   MIT
+* Author    Jean-Yves VET <contact[at]jean-yves.vet>
+* Copyright (c) 2023
+******************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* RUSAGE_THREAD */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <hip/hip_runtime.h>
+#include "libhits.h"
+#include "hits_kernels.h"
+#include <pthread.h>
+#include <numa.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define QOS_IDLE_SAMPLES        200         /* Probe copies per priority on idle GPUs */
+#define QOS_MAX_SAMPLES         1000000     /* Probe copies per priority under load */
+#define VERIFY_CHUNK_SIZE       (4 << 20)   /* 4MiB checksum granularity */
+#define VERIFY_MAX_REPORTED     8           /* Corrupted iterations listed per transfer */
+#define POOL_SIZE_MIN           4096        /* Smallest size class of pooled buffers */
+#define PAGEABLE_FLAGS          (is_populate | is_hugepage | is_nohugepage | is_first_touch)
+#define POOL_SIZE_LARGE         (1L << 30)  /* Larger pooled buffers are rounded to steps */
+#define POOL_LARGE_STEP         (2L << 20)  /* 2MiB (huge page) rounding of large buffers */
+#define ALLOC_BENCH_SIZE_MIN    4096        /* Smallest buffer of the allocation benchmark */
+#define ALLOC_BENCH_SIZE_STEP   16          /* Size ratio between benchmarked buffers */
+#define ALLOC_BENCH_BUDGET      (1 << 30)   /* Bytes allocated per path and size at most */
+#define ALLOC_BENCH_MAX_DEVICES 64
+#define KFD_IOLINK_XGMI         11          /* KFD topology link type of xGMI */
+#define PLACEMENT_PAGES_MAX     65536       /* Host pages queried per buffer */
+#define PLACEMENT_LOCAL_MIN     99.0        /* Percentage of pages expected local */
+#define CPU_THREADS_MAX         512         /* Threads of the process accounted for */
+#define DRAM_COUNTERS_MAX       256         /* Uncore counters opened per run */
+#ifndef PERF_PMU_PATH
+#define PERF_PMU_PATH           "/sys/bus/event_source/devices"
+#endif
+
+/* Peer copies without compute units run on SDMA engines, HIP-CPU has no such copy kind */
+#ifdef __HIP_PLATFORM_AMD__
+#define MEMCPY_DTOD_SDMA        hipMemcpyDeviceToDeviceNoCU
+#else
+#define MEMCPY_DTOD_SDMA        hipMemcpyDeviceToDevice
+#endif
+
+/* Error target of the API call running in the current thread (NULL outside) */
+static __thread jmp_buf *hits_jmp = NULL;
+
+/**
+ * Abort the current API call with an error code. Threads spawned by the
+ * library catch their errors with _hits_catch and report them to the API
+ * call. Teardown functions do not abort (see releaseHip), so an error target
+ * is always set.
+ *
+ * @param   code[in]  Error code returned by the API call
+ */
+static void hits_abort(const int code)
+{
+    assert(hits_jmp != NULL);
+    longjmp(*hits_jmp, code);
+}
+
+#define checkHip(ret) { assertHip((ret), __FILE__, __LINE__); }
+static void assertHip(hipError_t code, const char *file, int line)
+{
+   if (code != hipSuccess)
+   {
+      fprintf(stderr,"CheckHip: %s %s %d\n", hipGetErrorString(code), file, line);
+      hits_abort(code);
+   }
+}
+
+/* Teardown keeps releasing resources after an error and keeps the first one */
+#define releaseHip(ret, err) { reportHip((ret), (err), __FILE__, __LINE__); }
+static void reportHip(hipError_t code, int *err, const char *file, int line)
+{
+   if (code != hipSuccess)
+   {
+      fprintf(stderr,"CheckHip: %s %s %d\n", hipGetErrorString(code), file, line);
+      if (*err == 0)
+         *err = code;
+   }
+}
+
+/**
+ * Run an internal function as an API call, turning its errors into a
+ * returned code
+ *
+ * @param   fn[in]       Internal function
+ * @param   hits[inout]  Main application structure
+ * @return  0 on success, error code otherwise
+ */
+static int _hits_call(void (*fn)(Hits_t *), Hits_t *hits)
+{
+    jmp_buf env;
+    jmp_buf *prev = hits_jmp;
+
+    int ret = setjmp(env);
+    if (ret == 0)
+    {
+        hits_jmp = &env;
+        fn(hits);
+    }
+
+    hits_jmp = prev;
+    return ret;
+}
+
+/**
+ * Run an internal function, turning its errors into a returned code. Used by
+ * library threads, and by functions releasing resources before passing an
+ * error on to the API call.
+ *
+ * @param   fn[in]       Internal function
+ * @param   arg[inout]   Argument of the function
+ * @return  0 on success, error code otherwise
+ */
+static int _hits_catch(void (*fn)(void *), void *arg)
+{
+    jmp_buf env;
+    jmp_buf *prev = hits_jmp;
+
+    int ret = setjmp(env);
+    if (ret == 0)
+    {
+        hits_jmp = &env;
+        fn(arg);
+    }
+
+    hits_jmp = prev;
+    return ret;
+}
+
+const char * const ttype_str[] =
+{
+    "Host to Device",
+    "Device to Host",
+    "Device to Device",
+    "Managed memory",
+};
+
+/* Transfer type names in result files */
+const char * const ttype_key[] =
+{
+    "htod",
+    "dtoh",
+    "dtod",
+    "managed",
+};
+
+const char * const engine_str[] =
+{
+    "auto",
+    "sdma",
+    "blit",
+    "kernel",
+};
+
+const char * const priority_str[] =
+{
+    "low",
+    "normal",
+    "high",
+};
+
+const char * const wait_str[] =
+{
+    "auto",
+    "spin",
+    "yield",
+    "blocking",
+    "callback",
+};
+
+static double _wtime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+/******************************************************************************
+ * Buffer pool: buffers are kept for the lifetime of the process and handed
+ * out again to later plans with the same key, so that sweeps and repeated
+ * scenarios do not allocate (and pin) memory they already hold.
+ ******************************************************************************/
+
+typedef struct PoolBuffer
+{
+    void       *ptr;        /* Buffer address                                */
+    size_t      n_bytes;    /* Capacity (size class)                         */
+    int         device;     /* GPU id, -1 for host buffers                   */
+    int         numa_node;  /* NUMA node of host buffers (-1 if not aware)   */
+    int         flags;      /* Allocation flags (pinned and mapped)          */
+    bool        is_used;    /* Handed out to a plan                          */
+} PoolBuffer_t;
+
+static PoolBuffer_t *pool = NULL;
+static int n_pool = 0;
+static int n_pool_alloc = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Round a size up to its class: four classes per power of two, so that at
+ * most a quarter of a buffer is wasted. Large buffers are only rounded to
+ * huge pages, as a quarter of them may not fit in memory.
+ *
+ * @param   n_bytes[in]  Requested size
+ * @return  Capacity of the size class
+ */
+static size_t pool_size_class(const size_t n_bytes)
+{
+    size_t pow2 = POOL_SIZE_MIN;
+
+    if (n_bytes > POOL_SIZE_LARGE)
+        return (n_bytes + POOL_LARGE_STEP - 1) / POOL_LARGE_STEP * POOL_LARGE_STEP;
+
+    while (pow2 * 2 <= n_bytes)
+        pow2 *= 2;
+
+    if (n_bytes <= pow2)
+        return pow2;
+
+    const size_t step = pow2 / 4;
+    return (n_bytes + step - 1) / step * step;
+}
+
+/**
+ * Allocate a pageable buffer with mmap, then apply the transparent huge page
+ * advice before any page is populated
+ *
+ * @param   n_bytes[in]    Buffer size
+ * @param   numa_node[in]  NUMA node to touch pages from (-1 if not aware)
+ * @param   flags[in]      Pageable allocation flags
+ * @return  Buffer address, NULL on failure
+ */
+static void* pageable_alloc(const size_t n_bytes, const int numa_node, const int flags)
+{
+    const bool is_advised = flags & (is_hugepage | is_nohugepage);
+    const int map_flags = MAP_PRIVATE | MAP_ANONYMOUS |
+                          ((flags & is_populate) && !is_advised ? MAP_POPULATE : 0);
+
+    void *ptr = mmap(NULL, n_bytes, PROT_READ | PROT_WRITE, map_flags, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    if (is_advised && madvise(ptr, n_bytes, (flags & is_hugepage) ? MADV_HUGEPAGE
+                                                                  : MADV_NOHUGEPAGE) != 0)
+        fprintf(stderr, "Warning: madvise(%s) failed (%s).\n",
+                (flags & is_hugepage) ? "MADV_HUGEPAGE" : "MADV_NOHUGEPAGE", strerror(errno));
+
+    const long page_size = sysconf(_SC_PAGESIZE);
+    volatile uint8_t *buf = (volatile uint8_t *)ptr;
+
+    /* Pages are placed on the node of the CPU touching them first */
+    if (flags & is_first_touch)
+    {
+        cpu_set_t cpus;
+        sched_getaffinity(0, sizeof(cpus), &cpus);
+
+        if (numa_node >= 0)
+            numa_run_on_node(numa_node);
+
+        for (size_t i = 0; i < n_bytes; i += page_size)
+            buf[i] = 0;
+
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+    else if ((flags & is_populate) && is_advised)
+    {
+#ifdef MADV_POPULATE_WRITE
+        if (madvise(ptr, n_bytes, MADV_POPULATE_WRITE) != 0)
+#endif
+        for (size_t i = 0; i < n_bytes; i += page_size)
+            buf[i] = 0;
+    }
+
+    return ptr;
+}
+
+/**
+ * Get a buffer from the pool, allocating it if no free buffer matches.
+ * Device buffers are allocated on the given device, host buffers on the
+ * current NUMA policy.
+ *
+ * @param   hits[inout]    Main application structure (allocation cost)
+ * @param   device[in]     GPU id, -1 for a host buffer
+ * @param   numa_node[in]  NUMA node of host buffers (-1 if not aware)
+ * @param   flags[in]      Allocation flags of host buffers
+ * @param   n_bytes[in]    Minimum size of the buffer
+ * @return  Buffer address
+ */
+static void* pool_get(Hits_t *hits, const int device, const int numa_node, const int flags,
+                      const size_t n_bytes)
+{
+    const size_t n_class = pool_size_class(n_bytes);
+    const int key_flags = (device < 0) ? (flags & ((flags & is_pinned) ? (is_pinned | is_mapped)
+                                                                      : PAGEABLE_FLAGS)) : 0;
+    const int key_node = (device < 0) ? numa_node : -1;
+    void *ptr = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < n_pool; i++)
+    {
+        PoolBuffer_t *b = &pool[i];
+        if (!b->is_used && b->device == device && b->numa_node == key_node &&
+            b->flags == key_flags && b->n_bytes == n_class)
+        {
+            b->is_used = true;
+            ptr = b->ptr;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (ptr != NULL)
+    {
+        hits->alloc_stats.n_reused++;
+        return ptr;
+    }
+
+    const double t_start = _wtime();
+    if (device >= 0)
+    {
+        checkHip( hipSetDevice(device) );
+        checkHip( hipMalloc(&ptr, n_class) );
+    }
+    else if (key_flags & is_pinned)
+    {
+        checkHip( hipHostMalloc(&ptr, n_class, hipHostMallocDefault | hipHostMallocNumaUser |
+                                ((key_flags & is_mapped) ? hipHostMallocMapped : 0)) );
+    }
+    else if (key_flags & PAGEABLE_FLAGS)
+        ptr = pageable_alloc(n_class, numa_node, key_flags);
+    else
+        ptr = malloc(n_class);
+
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "Error: cannot allocate a host buffer of %zu bytes.\n", n_class);
+        hits_abort(1);
+    }
+
+    hits->alloc_stats.seconds += _wtime() - t_start;
+    hits->alloc_stats.n_allocated++;
+    hits->alloc_stats.n_bytes += n_class;
+
+    pthread_mutex_lock(&pool_lock);
+    if (n_pool == n_pool_alloc)
+    {
+        n_pool_alloc = (n_pool_alloc > 0) ? n_pool_alloc * 2 : 16;
+        pool = (PoolBuffer_t *)realloc(pool, sizeof(PoolBuffer_t) * n_pool_alloc);
+        assert(pool != NULL);
+    }
+
+    PoolBuffer_t b = { ptr, n_class, device, key_node, key_flags, true };
+    pool[n_pool++] = b;
+    pthread_mutex_unlock(&pool_lock);
+
+    return ptr;
+}
+
+/**
+ * Give a buffer back to the pool
+ *
+ * @param   ptr[in]  Buffer address (NULL is ignored)
+ */
+static void pool_put(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < n_pool; i++)
+        if (pool[i].ptr == ptr)
+            pool[i].is_used = false;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Amount of pooled bytes that no plan currently uses
+ *
+ * @param   device[in]  GPU id, -1 for host buffers
+ * @return  Amount of bytes
+ */
+static size_t pool_free_bytes(const int device)
+{
+    size_t n_bytes = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < n_pool; i++)
+        if (!pool[i].is_used && pool[i].device == device)
+            n_bytes += pool[i].n_bytes;
+    pthread_mutex_unlock(&pool_lock);
+
+    return n_bytes;
+}
+
+size_t hits_pool_release(void)
+{
+    size_t n_bytes = 0;
+    int n = 0, err = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < n_pool; i++)
+    {
+        PoolBuffer_t *b = &pool[i];
+        if (b->is_used)
+        {
+            pool[n++] = *b;
+            continue;
+        }
+
+        /* Buffers failing to be freed are reported and dropped */
+        if (b->device >= 0)
+        {
+            releaseHip( hipSetDevice(b->device), &err );
+            releaseHip( hipFree(b->ptr), &err );
+        }
+        else if (b->flags & is_pinned)
+        {
+            releaseHip( hipHostFree(b->ptr), &err );
+        }
+        else if (b->flags & PAGEABLE_FLAGS)
+            munmap(b->ptr, b->n_bytes);
+        else
+            free(b->ptr);
+
+        n_bytes += b->n_bytes;
+    }
+
+    n_pool = n;
+    pthread_mutex_unlock(&pool_lock);
+
+    return n_bytes;
+}
+
+/**
+ * Create a non-blocking stream on the current device with a given priority.
+ * Normal priority streams are created at the default priority.
+ *
+ * @param   stream[out]   Created stream
+ * @param   device[in]    Current device
+ * @param   priority[in]  Priority level
+ */
+static void create_stream(hipStream_t *stream, const int device, const Priority_t priority)
+{
+    int least, greatest;
+
+    if (priority == PRIORITY_NORMAL)
+    {
+        checkHip( hipStreamCreateWithFlags(stream, hipStreamNonBlocking) );
+        return;
+    }
+
+    /* Lower values mean higher priorities */
+    checkHip( hipDeviceGetStreamPriorityRange(&least, &greatest) );
+    if (least == greatest)
+        fprintf(stderr, "Warning: Device %d does not support stream priorities.\n", device);
+
+    checkHip( hipStreamCreateWithPriority(stream, hipStreamNonBlocking,
+                                          (priority == PRIORITY_HIGH) ? greatest : least) );
+}
+
+/**
+ * Set the scheduling mode used by the current device to wait for completions
+ *
+ * @param   wait[in]    Completion wait strategy
+ * @param   device[in]  Current device
+ */
+static void set_wait_flags(const Wait_t wait, const int device)
+{
+    unsigned flags;
+
+    switch (wait)
+    {
+        case WAIT_SPIN:
+            flags = hipDeviceScheduleSpin;
+            break;
+        case WAIT_YIELD:
+            flags = hipDeviceScheduleYield;
+            break;
+        case WAIT_BLOCKING:
+            flags = hipDeviceScheduleBlockingSync;
+            break;
+        default:
+            return;
+    }
+
+    /* Some runtimes refuse new flags once the device is in use */
+    hipError_t ret = hipSetDeviceFlags(flags);
+    if (ret != hipSuccess)
+    {
+        fprintf(stderr, "Warning: cannot set the %s scheduling mode of Device %d (%s).\n",
+                wait_str[wait], device, hipGetErrorString(ret));
+        (void)hipGetLastError();
+    }
+}
+
+static void _transfer_init_common(const Hits_t *hits, Transfer_t *t)
+{
+    const unsigned event_flags = (hits->wait == WAIT_BLOCKING) ? hipEventBlockingSync : 0;
+
+    t->numa_node  = -1;
+    t->is_started = false;
+    t->n_faults   = 0;
+    t->mapped     = NULL;
+    t->engine     = ENGINE_AUTO;
+
+    checkHip( hipGetDeviceProperties(&t->prop_device, t->device) );
+    if (t->device2 >= 0)
+        checkHip( hipGetDeviceProperties(&t->prop_device2, t->device2) );
+
+    checkHip( hipSetDevice(t->device) );
+    set_wait_flags(hits->wait, t->device);
+
+    checkHip( hipEventCreateWithFlags(&t->start, event_flags) );
+    checkHip( hipEventCreateWithFlags(&t->stop, event_flags) );
+
+    create_stream(&t->stream, t->device, t->priority);
+}
+
+/**
+ * NUMA node local to a GPU
+ *
+ * @param   prop[in]  GPU properties
+ * @return  NUMA node, -1 if unknown
+ */
+static int gpu_numa_node(const struct hipDeviceProp_t *prop)
+{
+    char numa_file[PATH_MAX];
+    int numa_node = -1;
+    sprintf(numa_file, "/sys/class/pci_bus/%04x:%02x/device/numa_node",
+                       prop->pciDomainID, prop->pciBusID);
+
+    FILE* file = fopen(numa_file, "r");
+    if (file == NULL)
+        return -1;
+
+    if (fscanf(file, "%d", &numa_node) != 1)
+        numa_node = -1;
+    fclose(file);
+
+    return numa_node;
+}
+
+/**
+ * Set NUMA affinity based on GPU property.
+ *
+ * @param   t[in]  transfer structure
+ */
+static void set_numa_affinity(Transfer_t *t)
+{
+    const int numa_node = gpu_numa_node(&t->prop_device);
+    if (numa_node < 0)
+        return;
+
+    t->numa_node = numa_node;
+    numa_set_preferred(t->numa_node);
+}
+
+static void dtoh_transfer_init(Hits_t *hits, Transfer_t *t, const size_t n_bytes,
+                               const int alloc_flags)
+{
+    _transfer_init_common(hits, t);
+
+    if (alloc_flags & is_numa_aware)
+        set_numa_affinity(t);
+
+    t->dest = (float *)pool_get(hits, -1, t->numa_node, alloc_flags, n_bytes);
+
+    if (alloc_flags & is_mapped)
+        checkHip( hipHostGetDevicePointer(((void **)&t->mapped), t->dest, 0) );
+
+    t->src = (float *)pool_get(hits, t->device, -1, 0, n_bytes);
+}
+
+static void htod_transfer_init(Hits_t *hits, Transfer_t *t, const size_t n_bytes,
+                               const int alloc_flags)
+{
+    _transfer_init_common(hits, t);
+
+    if (alloc_flags & is_numa_aware)
+        set_numa_affinity(t);
+
+    t->src = (float *)pool_get(hits, -1, t->numa_node, alloc_flags, n_bytes);
+
+    if (alloc_flags & is_mapped)
+        checkHip( hipHostGetDevicePointer(((void **)&t->mapped), t->src, 0) );
+
+    t->dest = (float *)pool_get(hits, t->device, -1, 0, n_bytes);
+}
+
+static void managed_transfer_init(const Hits_t *hits, Transfer_t *t, const size_t n_bytes,
+                                  const int alloc_flags)
+{
+    _transfer_init_common(hits, t);
+
+    int is_managed = 0, is_concurrent = 0;
+    checkHip( hipDeviceGetAttribute(&is_managed, hipDeviceAttributeManagedMemory, t->device) );
+    checkHip( hipDeviceGetAttribute(&is_concurrent, hipDeviceAttributeConcurrentManagedAccess,
+                                    t->device) );
+    if (!is_managed)
+    {
+        fprintf(stderr, "Error: Device %d does not support managed memory.\n", t->device);
+        hits_abort(1);
+    }
+
+    if (!is_concurrent)
+        fprintf(stderr, "Warning: Device %d does not support concurrent managed access, pages "
+                        "may not migrate (HSA_XNACK=1 may be required).\n", t->device);
+
+    if (alloc_flags & is_numa_aware)
+        set_numa_affinity(t);
+
+    /* Source and destination are the same buffer moving back and forth */
+    checkHip( hipMallocManaged((void **)&t->src, n_bytes, hipMemAttachGlobal) );
+    t->dest = t->src;
+
+    /* Populate pages on the host so that the first iteration migrates them */
+    memset(t->src, 0, n_bytes);
+}
+
+static void dtod_transfer_init(Hits_t *hits, Transfer_t *t, const size_t n_bytes)
+{
+    _transfer_init_common(hits, t);
+
+    /* Ensure peer-to-peer access is possible between the two GPUs */
+    int is_access = 0;
+    hipDeviceCanAccessPeer(&is_access, t->device, t->device2);
+    if (!is_access)
+    {
+        fprintf(stderr, "Error: P2P cannot be enabled between devices %d and %d\n",
+                t->device, t->device2);
+        hits_abort(1);
+    }
+
+    t->dest = (float *)pool_get(hits, t->device, -1, 0, n_bytes);
+    t->src = (float *)pool_get(hits, t->device2, -1, 0, n_bytes);
+
+    /* Peer access stays enabled after the plans that needed it */
+    checkHip( hipSetDevice(t->device) );
+    hipError_t ret = hipDeviceEnablePeerAccess(t->device2, 0);
+    if (ret == hipErrorPeerAccessAlreadyEnabled)
+        (void)hipGetLastError();
+    else
+        checkHip( ret );
+}
+
+/**
+ * Size of the transfer buffers: one transfer, or the whole working set that
+ * cold runs rotate over, plus room for the largest swept offset
+ *
+ * @param   hits[in]  Main application structure
+ * @return  Amount of bytes
+ */
+static size_t buffer_size(const Hits_t *hits)
+{
+    size_t n_bytes = (hits->working_set > (size_t)hits->n_size) ? hits->working_set
+                                                                 : (size_t)hits->n_size;
+
+    for (int k = 0; k < hits->n_offsets; k++)
+        if (hits->offsets[k] > n_bytes - hits->n_size)
+            n_bytes = hits->n_size + hits->offsets[k];
+
+    return n_bytes;
+}
+
+/**
+ * Initialize all transfers
+ *
+ * @param   hits[inout]  Main application structure
+ */
+static void transfer_init(Hits_t *hits)
+{
+    const size_t n_bytes = buffer_size(hits);
+
+    /* Initialize all streams and buffers */
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        Transfer_t *t = &hits->transfer[i];
+
+        switch(t->type)
+        {
+            case DTOH:
+                dtoh_transfer_init(hits, t, n_bytes, hits->alloc_flags);
+                break;
+            case HTOD:
+                htod_transfer_init(hits, t, n_bytes, hits->alloc_flags);
+                break;
+            case DTOD:
+                dtod_transfer_init(hits, t, n_bytes);
+                break;
+            case MANAGED:
+                managed_transfer_init(hits, t, n_bytes, hits->alloc_flags);
+                break;
+        }
+
+        t->n_bytes = n_bytes;
+    }
+}
+
+/**
+ * Enqueue a pitched 2D copy (or 3D copy if the shape has several slices)
+ *
+ * @param   t[inout]    Transfer data
+ * @param   shape[in]   Geometry of the source and destination buffers
+ * @param   offset[in]  Offsets of the copied window in the source and destination buffers
+ * @param   kind[in]    Direction of the copy
+ */
+static void strided_copy(Transfer_t *t, const Shape_t *shape, const size_t offset[2],
+                         const hipMemcpyKind kind)
+{
+    uint8_t *src = (uint8_t *)t->src + offset[0];
+    uint8_t *dest = (uint8_t *)t->dest + offset[1];
+
+    if (shape->depth > 1)
+    {
+        hipMemcpy3DParms p;
+        memset(&p, 0, sizeof(p));
+        p.srcPtr = make_hipPitchedPtr(src, shape->pitch, shape->width, shape->height);
+        p.dstPtr = make_hipPitchedPtr(dest, shape->pitch, shape->width, shape->height);
+        p.extent = make_hipExtent(shape->width, shape->height, shape->depth);
+        p.kind   = kind;
+
+        checkHip( hipMemcpy3DAsync(&p, t->stream) );
+    }
+    else
+        checkHip( hipMemcpy2DAsync(dest, shape->pitch, src, shape->pitch,
+                                   shape->width, shape->height, kind, t->stream) );
+}
+
+/**
+ * Launch a direct transfer stream (Host to Device or Device to Host)
+ *
+ * @param   t[inout]     Transfe data
+ * @param   n_bytes[in]  Transfer size
+ * @param   shape[in]    Geometry of strided copies (height is 0 for linear copies)
+ * @param   offset[in]   Offsets of the copied window in the source and destination buffers
+ * @param   n_iter[in]   Iterations
+ */
+static void direct_transfer(Transfer_t *t, const size_t n_bytes, const Shape_t *shape,
+                            const size_t offset[2], const bool is_last_iter)
+{
+    uint8_t *src = (uint8_t *)t->src + offset[0];
+    uint8_t *dest = (uint8_t *)t->dest + offset[1];
+    uint8_t *mapped = (uint8_t *)t->mapped + offset[(t->type == DTOH) ? 1 : 0];
+
+    checkHip( hipSetDevice(t->device) );
+
+    if (!t->is_started)
+    {
+        checkHip( hipEventRecord(t->start, t->stream) );
+        t->is_started = true;
+    }
+
+    const hipMemcpyKind kind = (t->type == DTOH) ? hipMemcpyDeviceToHost : hipMemcpyHostToDevice;
+    if (t->engine == ENGINE_KERNEL)
+    {
+        /* The kernel reads or writes host memory through its device mapping */
+        checkHip( copy_kernel_launch((t->type == DTOH) ? mapped : dest,
+                                     (t->type == DTOH) ? src : mapped, n_bytes,
+                                     t->prop_device.multiProcessorCount * COPY_KERNEL_BLOCKS_PER_CU,
+                                     t->stream) );
+    }
+    else if (shape->height > 0)
+        strided_copy(t, shape, offset, kind);
+    else
+        checkHip( hipMemcpyAsync(dest, src, n_bytes, kind, t->stream) );
+
+    if (is_last_iter)
+        checkHip( hipEventRecord(t->stop, t->stream) );
+}
+
+/**
+ * Launch a peer-to-peer transfer stream
+ *
+ * @param   t[inout]     Transfe data
+ * @param   n_bytes[in]  Transfer size
+ * @param   shape[in]    Geometry of strided copies (height is 0 for linear copies)
+ * @param   offset[in]   Offsets of the copied window in the source and destination buffers
+ * @param   n_iter[in]   Iterations
+ */
+static void dtod_transfer(Transfer_t *t, const size_t n_bytes, const Shape_t *shape,
+                          const size_t offset[2], const bool is_last_iter)
+{
+    uint8_t *src = (uint8_t *)t->src + offset[0];
+    uint8_t *dest = (uint8_t *)t->dest + offset[1];
+
+    checkHip( hipSetDevice(t->device) );
+
+    if (!t->is_started)
+    {
+        checkHip( hipEventRecord(t->start, t->stream) );
+        t->is_started = true;
+    }
+
+    /* Peer access is enabled, so kernels and pitched copies can address both devices directly */
+    if (t->engine == ENGINE_KERNEL)
+    {
+        checkHip( copy_kernel_launch(dest, src, n_bytes,
+                                     t->prop_device.multiProcessorCount * COPY_KERNEL_BLOCKS_PER_CU,
+                                     t->stream) );
+    }
+    else if (shape->height > 0)
+        strided_copy(t, shape, offset, hipMemcpyDeviceToDevice);
+    else if (t->engine == ENGINE_SDMA)
+    {
+        checkHip( hipMemcpyAsync(dest, src, n_bytes, MEMCPY_DTOD_SDMA, t->stream) );
+    }
+    else
+        checkHip( hipMemcpyPeerAsync(dest, t->device, src, t->device2, n_bytes, t->stream) );
+
+    if (is_last_iter)
+        checkHip( hipEventRecord(t->stop, t->stream) );
+}
+
+/**
+ * Stream callback touching every page of a managed buffer from the host, so
+ * that pages migrate back on demand. Faults taken by the calling thread are
+ * accumulated in the transfer.
+ *
+ * @param   arg[inout]  Managed transfer
+ */
+static void _touch_pages(void *arg)
+{
+    Transfer_t *t = (Transfer_t *)arg;
+    volatile uint8_t *buf = (volatile uint8_t *)t->src;
+    const long page_size = sysconf(_SC_PAGESIZE);
+    struct rusage before, after;
+
+    getrusage(RUSAGE_THREAD, &before);
+
+    for (size_t i = 0; i < t->n_bytes; i += page_size)
+        buf[i] = buf[i];
+
+    getrusage(RUSAGE_THREAD, &after);
+    t->n_faults += (after.ru_minflt - before.ru_minflt) + (after.ru_majflt - before.ru_majflt);
+}
+
+/**
+ * Launch a managed memory migration stream (host to device and back)
+ *
+ * @param   t[inout]              Transfer data
+ * @param   n_bytes[in]           Transfer size
+ * @param   is_demand_fault[in]   Migrate back with host page faults instead of prefetch
+ * @param   is_last_iter[in]      True if this is the last iteration
+ */
+static void managed_transfer(Transfer_t *t, const size_t n_bytes, const bool is_demand_fault,
+                             const bool is_last_iter)
+{
+    checkHip( hipSetDevice(t->device) );
+
+    if (!t->is_started)
+    {
+        checkHip( hipEventRecord(t->start, t->stream) );
+        t->is_started = true;
+    }
+
+    checkHip( hipMemPrefetchAsync(t->src, n_bytes, t->device, t->stream) );
+
+    if (is_demand_fault)
+    {
+        checkHip( hipLaunchHostFunc(t->stream, &_touch_pages, t) );
+    }
+    else
+        checkHip( hipMemPrefetchAsync(t->src, n_bytes, hipCpuDeviceId, t->stream) );
+
+    if (is_last_iter)
+        checkHip( hipEventRecord(t->stop, t->stream) );
+}
+
+/**
+ * Describe how the host buffer of a transfer is allocated
+ *
+ * @param   hits[in]   Main application structure
+ * @param   t[in]      Transfer data
+ * @param   str[out]   Description
+ * @param   n_str[in]  Size of the description buffer
+ */
+static void host_alloc_str(const Hits_t *hits, const Transfer_t *t, char *str, const size_t n_str)
+{
+    const int flags = hits->alloc_flags;
+
+    if (t->type == DTOD)
+        snprintf(str, n_str, "-");
+    else if (t->type == MANAGED)
+        snprintf(str, n_str, "managed");
+    else if (flags & is_pinned)
+        snprintf(str, n_str, "pinned%s", (flags & is_mapped) ? "+mapped" : "");
+    else
+        snprintf(str, n_str, "%s%s%s%s%s", (flags & PAGEABLE_FLAGS) ? "mmap" : "malloc",
+                 (flags & is_populate) ? "+populate" : "", (flags & is_hugepage) ? "+hugepage" : "",
+                 (flags & is_nohugepage) ? "+nohugepage" : "",
+                 (flags & is_first_touch) ? "+touch" : "");
+}
+
+/**
+ * Print which transfer is about to be launched
+ *
+ * @param   hits[in]  Main application structure
+ * @param   t[in]     Transfer data
+ */
+static void print_launch(const Hits_t *hits, const Transfer_t *t)
+{
+    char host_alloc[HOST_ALLOC_STR_MAX];
+    host_alloc_str(hits, t, host_alloc, sizeof(host_alloc));
+
+    switch (t->type)
+    {
+        case DTOD:
+            printf("Launching P2P PCIe transfers from Device %d (%x:%02x) to Device %d (%x:%02x) - "
+                   "Engine: %s - Priority: %s\n", t->device2, t->prop_device2.pciDomainID,
+                   t->prop_device2.pciBusID, t->device, t->prop_device.pciDomainID,
+                   t->prop_device.pciBusID, engine_str[t->engine], priority_str[t->priority]);
+            return;
+        case MANAGED:
+            printf("Launching managed memory migrations with Device %d (%x:%02x) - Priority: %s",
+                   t->device, t->prop_device.pciDomainID, t->prop_device.pciBusID,
+                   priority_str[t->priority]);
+
+            if (t->numa_node >= 0)
+                printf(" - Host pages allocated on NUMA node %d", t->numa_node);
+            break;
+        default:
+            printf("Launching %s transfers with Device %d (%x:%02x) - Engine: %s - Priority: %s",
+                   ttype_str[t->type], t->device, t->prop_device.pciDomainID,
+                   t->prop_device.pciBusID, engine_str[t->engine], priority_str[t->priority]);
+
+            if (t->numa_node >= 0)
+                printf(" - Host buffer allocated on NUMA node %d", t->numa_node);
+
+            printf(" - Host buffer: %s", host_alloc);
+            break;
+    }
+
+    printf("\n");
+}
+
+/**
+ * Enqueue one iteration of a transfer
+ *
+ * @param   hits[in]          Main application structure
+ * @param   t[inout]          Transfer data
+ * @param   offset[in]        Offset of the copied window in the buffers, moved by the
+ *                            source and destination offsets of the plan
+ * @param   is_last_iter[in]  True if this is the last iteration
+ */
+static void launch_transfer(const Hits_t *hits, Transfer_t *t, const size_t offset,
+                            const bool is_last_iter)
+{
+    const size_t offsets[2] = { offset + hits->src_offset, offset + hits->dest_offset };
+
+    switch (t->type)
+    {
+        case DTOD:
+            dtod_transfer(t, hits->n_size, &hits->shape, offsets, is_last_iter);
+            break;
+        case MANAGED:
+            managed_transfer(t, hits->n_size, hits->is_demand_fault, is_last_iter);
+            break;
+        default:
+            direct_transfer(t, hits->n_size, &hits->shape, offsets, is_last_iter);
+            break;
+    }
+}
+
+/**
+ * Display a dot every second as Heartbeat. Stop when transfers are completed.
+ *
+ * @param   arg[in]  Pointer to transfer state
+ */
+static void* heart_beat(void *arg)
+{
+    bool *is_transfering = (bool*)arg;
+    setbuf(stdout, NULL);
+
+    while (*is_transfering)
+    {
+        sleep(1);
+        printf(".");
+    }
+
+    return NULL;
+}
+
+/* Work shared by the threads processing a buffer chunk by chunk */
+typedef struct ChunkJob
+{
+    uint8_t        *buf;        /* Buffer to process                             */
+    size_t          n_bytes;    /* Size of the buffer                            */
+    size_t          n_chunks;   /* Amount of chunks in the buffer                */
+    size_t          next;       /* Next chunk to process (shared counter)        */
+    const Shape_t  *shape;      /* Geometry of the buffer (padding is zeroed)    */
+    uint64_t        seed;       /* Seed of the pattern (fill jobs)               */
+    uint32_t       *crc;        /* Checksum of each chunk (checksum jobs)        */
+    void          (*process)(struct ChunkJob *job, size_t chunk);
+    int             status;     /* Error code of a failed thread (0 if none)     */
+} ChunkJob_t;
+
+static uint32_t crc32c_table[256];
+static uint32_t (*crc32c_lane)(uint32_t crc, const uint8_t *buf, size_t n_bytes);
+static void (*crc32c_lanes)(uint32_t crc[3], const uint8_t *buf, size_t lane);
+
+static uint32_t crc32c_lane_sw(uint32_t crc, const uint8_t *buf, size_t n_bytes)
+{
+    for (size_t i = 0; i < n_bytes; i++)
+        crc = crc32c_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+static void crc32c_lanes_sw(uint32_t crc[3], const uint8_t *buf, size_t lane)
+{
+    for (int l = 0; l < 3; l++)
+        crc[l] = crc32c_lane_sw(crc[l], buf + l * lane, lane);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_lane_hw(uint32_t crc, const uint8_t *buf, size_t n_bytes)
+{
+    uint64_t c = crc;
+    size_t i = 0;
+
+    for (; i + 8 <= n_bytes; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+    }
+
+    for (; i < n_bytes; i++)
+        c = _mm_crc32_u8((uint32_t)c, buf[i]);
+
+    return (uint32_t)c;
+}
+
+/* The three dependency chains are interleaved so that the CRC32C instructions
+   of one lane execute during the latency of the others */
+__attribute__((target("sse4.2")))
+static void crc32c_lanes_hw(uint32_t crc[3], const uint8_t *buf, size_t lane)
+{
+    uint64_t c0 = crc[0], c1 = crc[1], c2 = crc[2];
+
+    for (size_t i = 0; i < lane; i += 8)
+    {
+        uint64_t w0, w1, w2;
+        memcpy(&w0, buf + i, sizeof(w0));
+        memcpy(&w1, buf + lane + i, sizeof(w1));
+        memcpy(&w2, buf + 2 * lane + i, sizeof(w2));
+        c0 = _mm_crc32_u64(c0, w0);
+        c1 = _mm_crc32_u64(c1, w1);
+        c2 = _mm_crc32_u64(c2, w2);
+    }
+
+    crc[0] = (uint32_t)c0;
+    crc[1] = (uint32_t)c1;
+    crc[2] = (uint32_t)c2;
+}
+#endif
+
+/**
+ * Select the CRC32C implementation (SSE4.2 instruction when available).
+ */
+static void crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        crc32c_table[i] = c;
+    }
+
+    crc32c_lane  = crc32c_lane_sw;
+    crc32c_lanes = crc32c_lanes_sw;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc32c_lane  = crc32c_lane_hw;
+        crc32c_lanes = crc32c_lanes_hw;
+    }
+#endif
+}
+
+/**
+ * Checksum a chunk. The chunk is split into three lanes hashed in a single
+ * interleaved loop, the tail is appended to the last lane, then the lane
+ * results are chained. Checksums are only compared with each other, so they
+ * do not need to match a canonical CRC32C.
+ *
+ * @param   buf[in]      Chunk to checksum
+ * @param   n_bytes[in]  Size of the chunk
+ * @return  Checksum of the chunk
+ */
+static uint32_t chunk_checksum(const uint8_t *buf, size_t n_bytes)
+{
+    const size_t lane = (n_bytes / 3) & ~(size_t)7;
+    uint32_t lanes[3] = { ~0U, ~0U, ~0U };
+
+    crc32c_lanes(lanes, buf, lane);
+    lanes[2] = crc32c_lane(lanes[2], buf + 3 * lane, n_bytes - 3 * lane);
+
+    return ~crc32c_lane(~0U, (const uint8_t *)lanes, sizeof(lanes));
+}
+
+static void _checksum_chunk(ChunkJob_t *job, size_t chunk)
+{
+    const size_t lo = chunk * VERIFY_CHUNK_SIZE;
+    const size_t hi = (lo + VERIFY_CHUNK_SIZE < job->n_bytes) ? lo + VERIFY_CHUNK_SIZE : job->n_bytes;
+
+    job->crc[chunk] = chunk_checksum(job->buf + lo, hi - lo);
+}
+
+static uint64_t _splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static void _fill_chunk(ChunkJob_t *job, size_t chunk)
+{
+    const size_t lo = chunk * VERIFY_CHUNK_SIZE;
+    const size_t hi = (lo + VERIFY_CHUNK_SIZE < job->n_bytes) ? lo + VERIFY_CHUNK_SIZE : job->n_bytes;
+    uint64_t x = _splitmix64(job->seed ^ _splitmix64(chunk)) | 1;
+
+    for (size_t i = lo; i < hi; i += sizeof(uint64_t))
+    {
+        /* xorshift64 */
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(job->buf + i, &x, (hi - i < sizeof(x)) ? hi - i : sizeof(x));
+    }
+
+    /* Strided copies leave row padding untouched, keep it at zero */
+    const Shape_t *shape = job->shape;
+    if (shape->height == 0 || shape->pitch == shape->width)
+        return;
+
+    for (size_t row = lo / shape->pitch * shape->pitch; row < hi; row += shape->pitch)
+    {
+        size_t pad_lo = (row + shape->width > lo) ? row + shape->width : lo;
+        size_t pad_hi = (row + shape->pitch < hi) ? row + shape->pitch : hi;
+        if (pad_lo < pad_hi)
+            memset(job->buf + pad_lo, 0, pad_hi - pad_lo);
+    }
+}
+
+static void _chunk_loop(void *arg)
+{
+    ChunkJob_t *job = (ChunkJob_t *)arg;
+    size_t chunk;
+
+    while ((chunk = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n_chunks)
+        job->process(job, chunk);
+}
+
+static void* _chunk_worker(void *arg)
+{
+    ChunkJob_t *job = (ChunkJob_t *)arg;
+
+    const int ret = _hits_catch(&_chunk_loop, job);
+    if (ret != 0)
+        __atomic_store_n(&job->status, ret, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+/**
+ * Process all chunks of a buffer with one thread per online CPU.
+ *
+ * @param   job[inout]  Job description
+ */
+static void run_chunk_job(ChunkJob_t *job)
+{
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads < 1)
+        n_threads = 1;
+    if ((size_t)n_threads > job->n_chunks)
+        n_threads = job->n_chunks;
+
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * n_threads);
+    assert(threads != NULL);
+
+    job->next   = 0;
+    job->status = 0;
+    for (long i = 0; i < n_threads; i++)
+        pthread_create(&threads[i], NULL, &_chunk_worker, job);
+
+    for (long i = 0; i < n_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+
+    if (job->status != 0)
+        hits_abort(job->status);
+}
+
+/* Verification pass, its buffers are released even when a HIP error aborts it */
+typedef struct Verify
+{
+    Hits_t     *hits;
+    int         e;              /* Index of the engine in the compared engines  */
+    uint8_t    *stage;          /* Pinned host buffer to fill and read back GPUs */
+    uint32_t   *ref;            /* Checksums of the sources                      */
+    uint32_t   *crc;            /* Checksums of a destination                    */
+    size_t     *n_bad;          /* Corrupted iterations per transfer             */
+    size_t     *bad_iter;       /* First corrupted iterations per transfer       */
+    size_t     *bad_chunks;     /* Corrupted chunks of these iterations          */
+} Verify_t;
+
+static void _verify_transfers(void *arg)
+{
+    Verify_t *v = (Verify_t *)arg;
+    Hits_t *hits = v->hits;
+    const int e = v->e;
+    const size_t n_bytes = hits->n_size;
+    const size_t n_chunks = (n_bytes + VERIFY_CHUNK_SIZE - 1) / VERIFY_CHUNK_SIZE;
+    const double t_start = _wtime();
+
+    if (hits->is_verbose)
+        printf("Verifying transfers");
+
+    crc32c_init();
+
+    checkHip( hipHostMalloc((void **)&v->stage, n_bytes, hipHostMallocDefault) );
+
+    uint8_t *stage = v->stage;
+    uint32_t *ref = v->ref = (uint32_t *)malloc(sizeof(uint32_t) * n_chunks * hits->n_transfers);
+    uint32_t *crc = v->crc = (uint32_t *)malloc(sizeof(uint32_t) * n_chunks);
+    size_t *n_bad = v->n_bad = (size_t *)calloc(hits->n_transfers, sizeof(size_t));
+    size_t *bad_iter = v->bad_iter =
+        (size_t *)malloc(sizeof(size_t) * VERIFY_MAX_REPORTED * hits->n_transfers);
+    size_t *bad_chunks = v->bad_chunks =
+        (size_t *)malloc(sizeof(size_t) * VERIFY_MAX_REPORTED * hits->n_transfers);
+    assert(ref != NULL && crc != NULL && n_bad != NULL && bad_iter != NULL && bad_chunks != NULL);
+
+    /* Fill sources with a distinct pattern per transfer and keep their checksums */
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        Transfer_t *t = &hits->transfer[i];
+        const bool is_host_src = (t->type == HTOD || t->type == MANAGED);
+        uint8_t *image = is_host_src ? (uint8_t *)t->src : stage;
+
+        ChunkJob_t fill = { image, n_bytes, n_chunks, 0, &hits->shape, hits->seed + i, NULL,
+                            &_fill_chunk, 0 };
+        run_chunk_job(&fill);
+
+        ChunkJob_t sum = { image, n_bytes, n_chunks, 0, &hits->shape, 0, &ref[i * n_chunks],
+                           &_checksum_chunk, 0 };
+        run_chunk_job(&sum);
+
+        if (!is_host_src)
+        {
+            checkHip( hipSetDevice((t->type == DTOD) ? t->device2 : t->device) );
+            checkHip( hipMemcpy(t->src, stage, n_bytes, hipMemcpyHostToDevice) );
+        }
+    }
+
+    for (size_t it = 0; it < (size_t)hits->n_iter; it++)
+    {
+        /* Clear destinations then copy again, all transfers running concurrently. Managed
+           buffers are their own source, they are checked after a round trip instead. */
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            Transfer_t *t = &hits->transfer[i];
+            checkHip( hipSetDevice(t->device) );
+
+            if (t->type == DTOH)
+                memset(t->dest, 0, n_bytes);
+            else if (t->type != MANAGED)
+                checkHip( hipMemsetAsync(t->dest, 0, n_bytes, t->stream) );
+
+            launch_transfer(hits, t, 0, false);
+        }
+
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            checkHip( hipSetDevice(hits->transfer[i].device) );
+            checkHip( hipStreamSynchronize(hits->transfer[i].stream) );
+        }
+
+        /* Compare destination checksums with source ones */
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            Transfer_t *t = &hits->transfer[i];
+            const bool is_host_dest = (t->type == DTOH || t->type == MANAGED);
+            uint8_t *image = is_host_dest ? (uint8_t *)t->dest : stage;
+
+            if (!is_host_dest)
+            {
+                checkHip( hipSetDevice(t->device) );
+                checkHip( hipMemcpy(stage, t->dest, n_bytes, hipMemcpyDeviceToHost) );
+            }
+
+            ChunkJob_t sum = { image, n_bytes, n_chunks, 0, &hits->shape, 0, crc,
+                               &_checksum_chunk, 0 };
+            run_chunk_job(&sum);
+
+            size_t n_mismatch = 0;
+            for (size_t c = 0; c < n_chunks; c++)
+                n_mismatch += (crc[c] != ref[i * n_chunks + c]);
+
+            if (n_mismatch == 0)
+                continue;
+
+            if (n_bad[i] < VERIFY_MAX_REPORTED)
+            {
+                bad_iter[i * VERIFY_MAX_REPORTED + n_bad[i]] = it;
+                bad_chunks[i * VERIFY_MAX_REPORTED + n_bad[i]] = n_mismatch;
+            }
+            n_bad[i]++;
+        }
+
+        if (hits->is_verbose)
+            printf(".");
+    }
+
+    for (int i = 0; i < hits->n_transfers; i++)
+        hits->transfer[i].n_corrupted[e] = n_bad[i];
+
+    if (hits->is_verbose)
+        printf("\nVerification completed in %.2f seconds (not included in bandwidth results).\n",
+               _wtime() - t_start);
+
+    for (int i = 0; i < hits->n_transfers && hits->is_verbose; i++)
+    {
+        printf("Transfer %d - Verification: ", i);
+        if (n_bad[i] == 0)
+        {
+            printf("OK (%ld iterations)\n", hits->n_iter);
+            continue;
+        }
+
+        printf("FAILED, %zu/%ld iterations corrupted (", n_bad[i], hits->n_iter);
+        for (size_t k = 0; k < n_bad[i] && k < VERIFY_MAX_REPORTED; k++)
+            printf("%siteration %zu: %zu/%zu chunks", (k > 0) ? ", " : "",
+                   bad_iter[i * VERIFY_MAX_REPORTED + k], bad_chunks[i * VERIFY_MAX_REPORTED + k],
+                   n_chunks);
+
+        printf("%s)\n", (n_bad[i] > VERIFY_MAX_REPORTED) ? ", ..." : "");
+    }
+}
+
+/**
+ * Check that destinations receive exactly what sources hold. Sources are
+ * filled with a seeded pattern, then each iteration clears destinations,
+ * copies again and compares per-chunk checksums with those of the sources.
+ * This pass runs after the timed one and is not accounted in bandwidth.
+ *
+ * @param   hits[inout]  Main application structure
+ * @param   e[in]        Index of the engine in the compared engines
+ */
+static void verify_transfers(Hits_t *hits, const int e)
+{
+    Verify_t v;
+    memset(&v, 0, sizeof(v));
+    v.hits = hits;
+    v.e    = e;
+
+    const int ret = _hits_catch(&_verify_transfers, &v);
+
+    free(v.ref);
+    free(v.crc);
+    free(v.n_bad);
+    free(v.bad_iter);
+    free(v.bad_chunks);
+
+    if (v.stage != NULL)
+        checkHip( hipHostFree(v.stage) );
+
+    if (ret != 0)
+        hits_abort(ret);
+}
+
+/**
+ * Issue probe copies alternately on the high and normal priority streams,
+ * timing each one from submission to completion.
+ *
+ * @param   q[inout]          QoS probe
+ * @param   lat[inout]        Sample sets (normal and high priority)
+ * @param   n_samples[in]     Maximum amount of samples per priority
+ * @param   is_running[in]    Sampling stops when false (NULL to ignore)
+ */
+static void _qos_sample(QosProbe_t *q, Latency_t lat[2], const size_t n_samples,
+                        const volatile bool *is_running)
+{
+    checkHip( hipSetDevice(q->device) );
+
+    while (lat[0].n < n_samples && (is_running == NULL || *is_running))
+    {
+        for (int p = 0; p < 2; p++)
+        {
+            const double t_start = _wtime();
+            checkHip( hipMemcpyAsync(q->dest, q->src, q->n_bytes, hipMemcpyHostToDevice,
+                                     q->stream[p]) );
+            checkHip( hipStreamSynchronize(q->stream[p]) );
+            lat[p].usec[lat[p].n++] = (_wtime() - t_start) * 1E6;
+        }
+    }
+}
+
+static void _qos_loaded(void *arg)
+{
+    QosProbe_t *q = (QosProbe_t *)arg;
+    _qos_sample(q, q->loaded, QOS_MAX_SAMPLES, q->is_running);
+}
+
+static void* _qos_worker(void *arg)
+{
+    QosProbe_t *q = (QosProbe_t *)arg;
+    q->status = _hits_catch(&_qos_loaded, q);
+
+    return NULL;
+}
+
+/**
+ * Allocate the QoS probe buffers and streams, then sample latency while the
+ * GPUs are idle.
+ *
+ * @param   hits[inout]  Main application structure (allocation cost)
+ * @param   q[inout]     QoS probe
+ */
+static void qos_init(Hits_t *hits, QosProbe_t *q)
+{
+    q->src = pool_get(hits, -1, -1, is_pinned, q->n_bytes);
+    q->dest = pool_get(hits, q->device, -1, 0, q->n_bytes);
+
+    checkHip( hipSetDevice(q->device) );
+    create_stream(&q->stream[0], q->device, PRIORITY_NORMAL);
+    create_stream(&q->stream[1], q->device, PRIORITY_HIGH);
+
+    for (int p = 0; p < 2; p++)
+    {
+        q->idle[p].usec   = (double *)malloc(sizeof(double) * QOS_IDLE_SAMPLES);
+        q->loaded[p].usec = (double *)malloc(sizeof(double) * QOS_MAX_SAMPLES);
+        assert(q->idle[p].usec != NULL && q->loaded[p].usec != NULL);
+        q->idle[p].n = 0;
+        q->loaded[p].n = 0;
+    }
+
+    _qos_sample(q, q->idle, QOS_IDLE_SAMPLES, NULL);
+}
+
+static void qos_fini(QosProbe_t *q, int *err)
+{
+    pool_put(q->src);
+    pool_put(q->dest);
+    q->src  = NULL;
+    q->dest = NULL;
+
+    releaseHip( hipSetDevice(q->device), err );
+
+    for (int p = 0; p < 2; p++)
+    {
+        releaseHip( hipStreamDestroy(q->stream[p]), err );
+        free(q->idle[p].usec);
+        free(q->loaded[p].usec);
+    }
+}
+
+static int _cmp_double(const void *a, const void *b)
+{
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Sort samples and return a percentile
+ *
+ * @param   lat[inout]   Samples
+ * @param   pct[in]      Percentile (0 to 100)
+ * @return  Latency in microseconds
+ */
+static double _percentile(Latency_t *lat, const double pct)
+{
+    if (lat->n == 0)
+        return 0;
+
+    qsort(lat->usec, lat->n, sizeof(double), &_cmp_double);
+    return lat->usec[(size_t)((lat->n - 1) * pct / 100.0)];
+}
+
+/**
+ * Print probe latency for both priorities, idle and under load. Priorities
+ * protect latency when the p99 of the high priority stream inflates less than
+ * the one of the normal priority stream.
+ *
+ * @param   q[inout]  QoS probe
+ */
+void hits_print_qos(QosProbe_t *q)
+{
+    double p99_inflation[2];
+
+    printf("QoS probe - %zu bytes Host to Device copies on Device %d:\n", q->n_bytes, q->device);
+
+    for (int p = 1; p >= 0; p--)
+    {
+        const double idle_p99 = _percentile(&q->idle[p], 99);
+        const double load_p99 = _percentile(&q->loaded[p], 99);
+        p99_inflation[p] = (idle_p99 > 0) ? load_p99 / idle_p99 : 0;
+
+        printf("  %-6s priority: idle p50 %.1f us, p99 %.1f us - loaded p50 %.1f us, p99 %.1f us, "
+               "max %.1f us (%zu samples) - p99 x%.2f\n", (p == 1) ? "high" : "normal",
+               _percentile(&q->idle[p], 50), idle_p99, _percentile(&q->loaded[p], 50), load_p99,
+               _percentile(&q->loaded[p], 100), q->loaded[p].n, p99_inflation[p]);
+    }
+
+    if (q->loaded[0].n == 0)
+        printf("  No probe copy completed while transfers were running, increase --iter.\n");
+    else if (p99_inflation[1] > 0)
+        printf("  Priority protection: %.2f (normal over high priority p99 inflation, above 1 "
+               "when priorities protect latency)\n", p99_inflation[0] / p99_inflation[1]);
+}
+
+/* CPU time counters at one point of a run */
+typedef struct CpuSample
+{
+    double              wtime;                      /* Wall-clock time                */
+    struct rusage       usage;                      /* Process CPU time               */
+    int                 n_threads;                  /* Threads found in /proc         */
+    int                 tid[CPU_THREADS_MAX];       /* Thread ids                     */
+    unsigned long long  ticks[CPU_THREADS_MAX];     /* User + system clock ticks      */
+    char                name[CPU_THREADS_MAX][16];  /* Thread names                   */
+    unsigned long long  node_ticks[CPU_NODES_MAX];  /* Busy clock ticks per NUMA node */
+} CpuSample_t;
+
+/**
+ * Read user and system clock ticks of each thread of the process
+ *
+ * @param   s[inout]  Sample
+ */
+static void cpu_sample_threads(CpuSample_t *s)
+{
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *entry;
+
+    s->n_threads = 0;
+    if (dir == NULL)
+        return;
+
+    while ((entry = readdir(dir)) != NULL && s->n_threads < CPU_THREADS_MAX)
+    {
+        char path[64], line[512];
+        unsigned long long utime, stime;
+
+        const int tid = atoi(entry->d_name);
+        if (tid <= 0)
+            continue;
+
+        snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+            continue;
+
+        char *ret = fgets(line, sizeof(line), file);
+        fclose(file);
+
+        /* The name is enclosed in parentheses and may contain spaces */
+        char *name = (ret != NULL) ? strchr(line, '(') : NULL;
+        char *end  = (ret != NULL) ? strrchr(line, ')') : NULL;
+        if (name == NULL || end == NULL || end < name ||
+            sscanf(end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                   &utime, &stime) != 2)
+            continue;
+
+        const int i = s->n_threads++;
+        s->tid[i]   = tid;
+        s->ticks[i] = utime + stime;
+        snprintf(s->name[i], sizeof(s->name[i]), "%.*s", (int)(end - name - 1), name + 1);
+    }
+
+    closedir(dir);
+}
+
+/**
+ * Read busy clock ticks of all CPUs of the system, summed per NUMA node
+ *
+ * @param   s[inout]  Sample
+ */
+static void cpu_sample_nodes(CpuSample_t *s)
+{
+    FILE *file = fopen("/proc/stat", "r");
+    char line[512];
+
+    memset(s->node_ticks, 0, sizeof(s->node_ticks));
+    if (file == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long long user, nice, sys, idle, iowait, irq, softirq, steal = 0;
+        int cpu;
+
+        /* Per-CPU lines only, the first line sums all CPUs */
+        if (strncmp(line, "cpu", 3) != 0 || line[3] < '0' || line[3] > '9')
+            continue;
+
+        if (sscanf(line + 3, "%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu, &user, &nice,
+                   &sys, &idle, &iowait, &irq, &softirq, &steal) < 8)
+            continue;
+
+        const int node = (numa_available() >= 0) ? numa_node_of_cpu(cpu) : 0;
+        if (node >= 0 && node < CPU_NODES_MAX)
+            s->node_ticks[node] += user + nice + sys + irq + softirq + steal;
+    }
+
+    fclose(file);
+}
+
+/**
+ * Sample CPU time counters of the process and of the system
+ *
+ * @param   s[out]  Sample
+ */
+static void cpu_sample(CpuSample_t *s)
+{
+    s->wtime = _wtime();
+    getrusage(RUSAGE_SELF, &s->usage);
+    cpu_sample_threads(s);
+    cpu_sample_nodes(s);
+}
+
+/**
+ * Account CPU time spent between two samples
+ *
+ * @param   hits[in]     Main application structure
+ * @param   before[in]   Sample taken when transfers were launched
+ * @param   after[in]    Sample taken when transfers completed
+ * @param   cpu[out]     CPU cost of the run
+ */
+static void cpu_account(const Hits_t *hits, const CpuSample_t *before,
+                        const CpuSample_t *after, CpuStats_t *cpu)
+{
+    const double tick = 1.0 / sysconf(_SC_CLK_TCK);
+    const struct timeval *u0 = &before->usage.ru_utime, *u1 = &after->usage.ru_utime;
+    const struct timeval *s0 = &before->usage.ru_stime, *s1 = &after->usage.ru_stime;
+
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->seconds = after->wtime - before->wtime;
+    cpu->user    = (u1->tv_sec - u0->tv_sec) + (u1->tv_usec - u0->tv_usec) / 1E6;
+    cpu->sys     = (s1->tv_sec - s0->tv_sec) + (s1->tv_usec - s0->tv_usec) / 1E6;
+
+    /* Threads created during the run start from zero */
+    for (int i = 0; i < after->n_threads; i++)
+    {
+        unsigned long long ticks = after->ticks[i];
+        for (int j = 0; j < before->n_threads; j++)
+            if (before->tid[j] == after->tid[i])
+                ticks -= before->ticks[j];
+
+        if (ticks == 0)
+            continue;
+
+        cpu->n_threads++;
+        if (ticks * tick > cpu->thread_max)
+        {
+            cpu->thread_max = ticks * tick;
+            snprintf(cpu->thread_name, sizeof(cpu->thread_name), "%s", after->name[i]);
+        }
+    }
+
+    cpu->n_nodes = (numa_available() >= 0) ? numa_max_node() + 1 : 1;
+    if (cpu->n_nodes > CPU_NODES_MAX)
+        cpu->n_nodes = CPU_NODES_MAX;
+
+    for (int n = 0; n < cpu->n_nodes; n++)
+        cpu->node[n] = (after->node_ticks[n] - before->node_ticks[n]) * tick;
+
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        const Shape_t *shape = &hits->shape;
+        size_t n_moved = hits->n_size;
+
+        if (shape->height > 0)
+            n_moved = shape->width * shape->height * shape->depth;
+        else if (hits->transfer[i].type == MANAGED)
+            n_moved = 2 * hits->n_size;
+
+        cpu->n_gbytes += (double)n_moved * hits->n_iter / 1E9;
+    }
+}
+
+/**
+ * Print the host CPU cost of a run
+ *
+ * @param   hits[in]  Main application structure
+ * @param   cpu[in]   CPU cost of the run
+ */
+static void print_cpu_stats(const Hits_t *hits, const CpuStats_t *cpu)
+{
+    const double total = cpu->user + cpu->sys;
+
+    printf("Completion wait (%s): detected %.1f usec after the longest transfer (including "
+           "launch delay)\n", wait_str[hits->wait], cpu->wait_usec);
+
+    printf("Host CPU: %.3f CPU-seconds (user %.3f, system %.3f) over %.2f seconds for "
+           "%.3f GB moved: %.4f CPU-seconds/GB", total, cpu->user, cpu->sys, cpu->seconds,
+           cpu->n_gbytes, total / cpu->n_gbytes);
+
+    if (cpu->n_threads > 0)
+        printf(" - busiest of %d threads: %s (%.2f CPU-seconds)", cpu->n_threads,
+               cpu->thread_name, cpu->thread_max);
+
+    printf("\n    Busy CPU-seconds per NUMA node (all processes):");
+    for (int n = 0; n < cpu->n_nodes; n++)
+        printf(" node %d %.2f", n, cpu->node[n]);
+
+    printf("\n");
+}
+
+/**
+ * Read the first line of a small sysfs file
+ *
+ * @param   path[in]    File path
+ * @param   line[out]   First line without its trailing newline
+ * @param   n_line[in]  Size of the line buffer
+ * @return  0 on success, -1 if the file cannot be read
+ */
+static int read_sysfs_line(const char *path, char *line, const size_t n_line)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    char *ret = fgets(line, n_line, file);
+    fclose(file);
+    if (ret == NULL)
+        return -1;
+
+    line[strcspn(line, "\n")] = '\0';
+    return 0;
+}
+
+/* NUMA allocation and page migration counters at one point of a run */
+typedef struct NumaSample
+{
+    long        node[CPU_NODES_MAX][3]; /* numa_hit, numa_miss, numa_foreign */
+    int         n_nodes;                /* Nodes found in sysfs              */
+    long        pgmigrate_success;      /* Pages migrated (vmstat)           */
+    long        numa_pages_migrated;    /* Pages migrated by NUMA balancing  */
+} NumaSample_t;
+
+/**
+ * Sample NUMA statistics of each node and page migration counters
+ *
+ * @param   s[out]  Sample
+ */
+static void numa_sample(NumaSample_t *s)
+{
+    static const char * const keys[3] = { "numa_hit", "numa_miss", "numa_foreign" };
+    char path[128], key[64];
+    long value;
+
+    memset(s, 0, sizeof(*s));
+
+    for (int n = 0; n < CPU_NODES_MAX; n++)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/numastat", n);
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+            break;
+
+        while (fscanf(file, "%63s %ld", key, &value) == 2)
+            for (int k = 0; k < 3; k++)
+                if (strcmp(key, keys[k]) == 0)
+                    s->node[n][k] = value;
+
+        fclose(file);
+        s->n_nodes = n + 1;
+    }
+
+    FILE *file = fopen("/proc/vmstat", "r");
+    if (file == NULL)
+        return;
+
+    while (fscanf(file, "%63s %ld", key, &value) == 2)
+    {
+        if (strcmp(key, "pgmigrate_success") == 0)
+            s->pgmigrate_success = value;
+        else if (strcmp(key, "numa_pages_migrated") == 0)
+            s->numa_pages_migrated = value;
+    }
+
+    fclose(file);
+}
+
+/**
+ * Account NUMA statistics between two samples and warn about migrations,
+ * which change the placement of the measured buffers
+ *
+ * @param   before[in]  Sample taken when transfers were launched
+ * @param   after[in]   Sample taken when transfers completed
+ * @param   numa[out]   NUMA statistics of the run
+ */
+static void numa_account(const NumaSample_t *before, const NumaSample_t *after,
+                         NumaStats_t *numa)
+{
+    numa->n_nodes = after->n_nodes;
+    for (int n = 0; n < after->n_nodes; n++)
+    {
+        numa->hit[n]     = after->node[n][0] - before->node[n][0];
+        numa->miss[n]    = after->node[n][1] - before->node[n][1];
+        numa->foreign[n] = after->node[n][2] - before->node[n][2];
+    }
+
+    numa->pgmigrate_success   = after->pgmigrate_success - before->pgmigrate_success;
+    numa->numa_pages_migrated = after->numa_pages_migrated - before->numa_pages_migrated;
+
+    if (numa->pgmigrate_success > 0 || numa->numa_pages_migrated > 0)
+    {
+        char balancing[16] = "?";
+        read_sysfs_line("/proc/sys/kernel/numa_balancing", balancing, sizeof(balancing));
+
+        fprintf(stderr, "Warning: %ld pages were migrated during the run (%ld by NUMA "
+                        "balancing, kernel.numa_balancing=%s), host buffers may not be on the "
+                        "intended node.\n", numa->pgmigrate_success,
+                        numa->numa_pages_migrated, balancing);
+    }
+}
+
+/**
+ * Print NUMA statistics of a run
+ *
+ * @param   numa[in]  NUMA statistics of the run
+ */
+static void print_numa_stats(const NumaStats_t *numa)
+{
+    if (numa->n_nodes == 0)
+        return;
+
+    printf("NUMA allocations (all processes):");
+    for (int n = 0; n < numa->n_nodes; n++)
+        printf(" node %d hit %ld miss %ld foreign %ld%s", n, numa->hit[n], numa->miss[n],
+               numa->foreign[n], (n < numa->n_nodes - 1) ? "," : "");
+
+    printf(" - pages migrated %ld (NUMA balancing %ld)\n", numa->pgmigrate_success,
+           numa->numa_pages_migrated);
+}
+
+/* Uncore memory controller counter opened on one CPU of a socket */
+typedef struct DramCounter
+{
+    int         fd;             /* perf_event file descriptor             */
+    int         socket;         /* Socket of the memory controller        */
+    bool        is_write;       /* Counts writes (reads otherwise)        */
+    double      scale;          /* Bytes per count                        */
+    uint64_t    start;          /* Count when transfers were launched     */
+} DramCounter_t;
+
+typedef struct DramCounters
+{
+    DramCounter_t   counter[DRAM_COUNTERS_MAX];
+    int             n;          /* Amount of opened counters              */
+    double          wtime;      /* Time at which counting started         */
+} DramCounters_t;
+
+/**
+ * Build the perf_event configuration of a named PMU event from its sysfs
+ * description (e.g. "event=0x04,umask=0x03" with format "config:0-7")
+ *
+ * @param   pmu[in]     PMU name
+ * @param   event[in]   Event name
+ * @param   attr[out]   Event attributes (type and config fields)
+ * @param   scale[out]  Bytes per count
+ * @return  0 on success, -1 if the PMU does not describe this event
+ */
+static int pmu_event_attr(const char *pmu, const char *event, struct perf_event_attr *attr,
+                          double *scale)
+{
+    char path[PATH_MAX], desc[256], format[64];
+
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+
+    snprintf(path, sizeof(path), PERF_PMU_PATH "/%s/type", pmu);
+    if (read_sysfs_line(path, desc, sizeof(desc)) != 0)
+        return -1;
+    attr->type = strtoul(desc, NULL, 10);
+
+    snprintf(path, sizeof(path), PERF_PMU_PATH "/%s/events/%s", pmu, event);
+    if (read_sysfs_line(path, desc, sizeof(desc)) != 0)
+        return -1;
+
+    for (char *save, *term = strtok_r(desc, ",", &save); term != NULL;
+         term = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(term, '=');
+        const uint64_t v = (value != NULL) ? strtoull(value + 1, NULL, 0) : 1;
+        if (value != NULL)
+            *value = '\0';
+
+        /* Bits of the term in one of the config fields, e.g. "config:8-15" */
+        unsigned lo, hi;
+        char field[16];
+        snprintf(path, sizeof(path), PERF_PMU_PATH "/%s/format/%s", pmu, term);
+        if (read_sysfs_line(path, format, sizeof(format)) != 0)
+            return -1;
+
+        const int n = sscanf(format, "%15[^:]:%u-%u", field, &lo, &hi);
+        if (n < 2)
+            return -1;
+
+        const uint64_t bits = v << lo;
+        if (strcmp(field, "config") == 0)
+            attr->config |= bits;
+        else if (strcmp(field, "config1") == 0)
+            attr->config1 |= bits;
+        else if (strcmp(field, "config2") == 0)
+            attr->config2 |= bits;
+        else
+            return -1;
+    }
+
+    /* Counts are scaled to a unit, MiB for memory controllers */
+    *scale = 1;
+    snprintf(path, sizeof(path), PERF_PMU_PATH "/%s/events/%s.scale", pmu, event);
+    if (read_sysfs_line(path, desc, sizeof(desc)) == 0)
+        *scale = strtod(desc, NULL);
+
+    snprintf(path, sizeof(path), PERF_PMU_PATH "/%s/events/%s.unit", pmu, event);
+    if (read_sysfs_line(path, desc, sizeof(desc)) == 0 && strcmp(desc, "MiB") == 0)
+        *scale *= 1 << 20;
+
+    return 0;
+}
+
+/**
+ * Socket of a CPU
+ *
+ * @param   cpu[in]  CPU id
+ * @return  Physical package id, 0 if unknown
+ */
+static int cpu_socket(const int cpu)
+{
+    char path[128], line[32];
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+             cpu);
+    if (read_sysfs_line(path, line, sizeof(line)) != 0)
+        return 0;
+
+    return atoi(line);
+}
+
+/**
+ * Open the read and write byte counters of every uncore memory controller,
+ * on one CPU of each socket, and start counting
+ *
+ * @param   d[out]  Opened counters (none if unavailable)
+ */
+static void dram_open(DramCounters_t *d)
+{
+    static const char * const events[2] = { "cas_count_read", "cas_count_write" };
+    static bool is_warned = false;
+    DIR *dir = opendir(PERF_PMU_PATH);
+    struct dirent *entry;
+    int err = 0;
+
+    d->n = 0;
+    while (dir != NULL && (entry = readdir(dir)) != NULL)
+    {
+        char path[PATH_MAX], cpumask[256];
+
+        snprintf(path, sizeof(path), PERF_PMU_PATH "/%s/cpumask", entry->d_name);
+        if (entry->d_name[0] == '.' || read_sysfs_line(path, cpumask, sizeof(cpumask)) != 0)
+            continue;
+
+        for (int w = 0; w < 2; w++)
+        {
+            struct perf_event_attr attr;
+            char cpus[sizeof(cpumask)];
+            double scale;
+
+            if (pmu_event_attr(entry->d_name, events[w], &attr, &scale) != 0)
+                continue;
+
+            /* Uncore PMUs list one CPU per socket (ranges are not expected) */
+            snprintf(cpus, sizeof(cpus), "%s", cpumask);
+            for (char *save, *token = strtok_r(cpus, ",", &save); token != NULL;
+                 token = strtok_r(NULL, ",", &save))
+            {
+                const int cpu = atoi(token);
+                if (d->n == DRAM_COUNTERS_MAX)
+                    break;
+
+                const int fd = syscall(SYS_perf_event_open, &attr, -1, cpu, -1, 0);
+                if (fd < 0)
+                {
+                    err = errno;
+                    continue;
+                }
+
+                DramCounter_t *c = &d->counter[d->n++];
+                c->fd       = fd;
+                c->socket   = cpu_socket(cpu);
+                c->is_write = (w == 1);
+                c->scale    = scale;
+                if (read(fd, &c->start, sizeof(c->start)) != sizeof(c->start))
+                    c->start = 0;
+            }
+        }
+    }
+
+    if (dir != NULL)
+        closedir(dir);
+
+    if (d->n == 0 && !is_warned)
+    {
+        fprintf(stderr, "Warning: no uncore memory controller counter could be opened (%s), "
+                        "DRAM traffic is not reported.\n", (err != 0) ? strerror(err) :
+                        "no PMU with cas_count_read/cas_count_write events");
+        is_warned = true;
+    }
+
+    d->wtime = _wtime();
+}
+
+/**
+ * Stop counting and account DRAM traffic per socket
+ *
+ * @param   d[inout]    Opened counters, closed on return
+ * @param   dram[out]   DRAM traffic of the run (NULL to discard it)
+ */
+static void dram_close(DramCounters_t *d, DramStats_t *dram)
+{
+    if (dram != NULL)
+    {
+        memset(dram, 0, sizeof(*dram));
+        dram->seconds = _wtime() - d->wtime;
+    }
+
+    for (int i = 0; i < d->n; i++)
+    {
+        DramCounter_t *c = &d->counter[i];
+        uint64_t count;
+
+        if (dram != NULL && read(c->fd, &count, sizeof(count)) == sizeof(count) &&
+            c->socket < SOCKETS_MAX)
+        {
+            double *bytes = c->is_write ? dram->write : dram->read;
+            bytes[c->socket] += (count - c->start) * c->scale;
+
+            if (c->socket + 1 > dram->n_sockets)
+                dram->n_sockets = c->socket + 1;
+        }
+
+        close(c->fd);
+    }
+
+    d->n = 0;
+}
+
+/**
+ * Print DRAM traffic of a run per socket
+ *
+ * @param   dram[in]  DRAM traffic of the run
+ */
+static void print_dram_stats(const DramStats_t *dram)
+{
+    if (dram->n_sockets == 0)
+        return;
+
+    printf("DRAM traffic (uncore memory controllers, all processes):");
+    for (int s = 0; s < dram->n_sockets; s++)
+        printf(" socket %d read %.3f GB (%.3f GB/s) write %.3f GB (%.3f GB/s)%s", s,
+               dram->read[s] / 1E9, dram->read[s] / 1E9 / dram->seconds, dram->write[s] / 1E9,
+               dram->write[s] / 1E9 / dram->seconds, (s < dram->n_sockets - 1) ? "," : "");
+
+    printf("\n");
+}
+
+/**
+ * Record on each stream an anchor event and the host time at which it
+ * completed, so that iteration events can be placed on the host clock.
+ * Iteration events are (re)created as needed.
+ *
+ * @param   hits[inout]     Main application structure
+ * @param   wtime[out]      Host time of the anchor of each transfer
+ */
+static void trace_anchor(Hits_t *hits, double *wtime)
+{
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        Transfer_t *t = &hits->transfer[i];
+        checkHip( hipSetDevice(t->device) );
+
+        if (t->n_trace_events < hits->n_iter + 1)
+        {
+            for (long k = 0; k < t->n_trace_events; k++)
+                checkHip( hipEventDestroy(t->trace_events[k]) );
+            free(t->trace_events);
+
+            t->n_trace_events = 0;
+            t->trace_events = (hipEvent_t *)malloc(sizeof(hipEvent_t) * (hits->n_iter + 1));
+            assert(t->trace_events != NULL);
+
+            for (; t->n_trace_events < hits->n_iter + 1; t->n_trace_events++)
+                checkHip( hipEventCreate(&t->trace_events[t->n_trace_events]) );
+        }
+
+        checkHip( hipEventRecord(t->trace_events[0], t->stream) );
+        checkHip( hipEventSynchronize(t->trace_events[0]) );
+        wtime[i] = _wtime();
+    }
+
+    if (hits->n_trace == 0)
+        hits->trace_epoch = wtime[0];
+}
+
+/**
+ * Append the spans of all iterations of the last run to the trace
+ *
+ * @param   hits[inout]     Main application structure
+ * @param   wtime[in]       Host time of the anchor of each transfer
+ * @param   is_cold[in]     The run rotated over the working set
+ */
+static void trace_collect(Hits_t *hits, const double *wtime, const bool is_cold)
+{
+    const size_t n_spans = hits->n_trace + (size_t)hits->n_transfers * hits->n_iter;
+
+    if (n_spans > hits->n_trace_alloc)
+    {
+        const size_t n_alloc = (n_spans > 2 * hits->n_trace_alloc) ? n_spans :
+                               2 * hits->n_trace_alloc;
+        TraceSpan_t *trace = (TraceSpan_t *)realloc(hits->trace, sizeof(TraceSpan_t) * n_alloc);
+        assert(trace != NULL);
+
+        hits->trace         = trace;
+        hits->n_trace_alloc = n_alloc;
+    }
+
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        Transfer_t *t = &hits->transfer[i];
+        const double usec_anchor = (wtime[i] - hits->trace_epoch) * 1E6;
+        float msec_begin = 0, msec_end;
+
+        checkHip( hipSetDevice(t->device) );
+        checkHip( hipEventElapsedTime(&msec_begin, t->trace_events[0], t->start) );
+
+        /* Each iteration ends where the next one begins on the stream */
+        for (long k = 0; k < hits->n_iter; k++)
+        {
+            TraceSpan_t *span = &hits->trace[hits->n_trace++];
+            checkHip( hipEventElapsedTime(&msec_end, t->trace_events[0],
+                                          t->trace_events[k + 1]) );
+
+            span->transfer   = i;
+            span->engine     = t->engine;
+            span->iter       = k;
+            span->is_cold    = is_cold;
+            span->begin_usec = usec_anchor + msec_begin * 1E3;
+            span->end_usec   = usec_anchor + msec_end * 1E3;
+            msec_begin       = msec_end;
+        }
+    }
+}
+
+/* Completions notified by host functions enqueued after the transfers */
+typedef struct HostDone
+{
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    int                 n_done;     /* Completed transfers                  */
+    double             *wtime;      /* Notification time of each transfer   */
+} HostDone_t;
+
+typedef struct HostDoneArg
+{
+    HostDone_t         *done;
+    int                 i;          /* Index of the transfer                */
+} HostDoneArg_t;
+
+static void _host_done(void *arg)
+{
+    HostDoneArg_t *a = (HostDoneArg_t *)arg;
+    HostDone_t *done = a->done;
+
+    pthread_mutex_lock(&done->lock);
+    done->wtime[a->i] = _wtime();
+    done->n_done++;
+    pthread_cond_signal(&done->cond);
+    pthread_mutex_unlock(&done->lock);
+}
+
+/**
+ * Wait for the completion of launched transfers with the wait strategy of
+ * the plan
+ *
+ * @param   hits[in]    Main application structure
+ * @param   first[in]   Index of the first launched transfer
+ * @param   last[in]    Index following the last launched transfer
+ * @return  Time at which the completion of the last transfer was detected
+ */
+static double wait_transfers(const Hits_t *hits, const int first, const int last)
+{
+    const int n_transfers = last - first;
+    double wtime = 0;
+
+    if (hits->wait != WAIT_CALLBACK)
+    {
+        for (int i = first; i < last; i++)
+        {
+            Transfer_t *t = &hits->transfer[i];
+            checkHip( hipSetDevice(t->device) );
+
+            /* Events wait as set by the device scheduling mode */
+            if (hits->wait == WAIT_AUTO)
+            {
+                checkHip( hipDeviceSynchronize() );
+            }
+            else
+            {
+                checkHip( hipEventSynchronize(t->stop) );
+            }
+        }
+
+        return _wtime();
+    }
+
+    /* Left allocated if a launch fails, host functions already enqueued may still run */
+    HostDone_t *done = (HostDone_t *)malloc(sizeof(HostDone_t));
+    HostDoneArg_t *args = (HostDoneArg_t *)malloc(sizeof(HostDoneArg_t) * n_transfers);
+    assert(done != NULL && args != NULL);
+    done->wtime = (double *)malloc(sizeof(double) * n_transfers);
+    assert(done->wtime != NULL);
+
+    pthread_mutex_init(&done->lock, NULL);
+    pthread_cond_init(&done->cond, NULL);
+    done->n_done = 0;
+
+    for (int i = 0; i < n_transfers; i++)
+    {
+        Transfer_t *t = &hits->transfer[first + i];
+        args[i].done = done;
+        args[i].i    = i;
+
+        checkHip( hipSetDevice(t->device) );
+        checkHip( hipLaunchHostFunc(t->stream, &_host_done, &args[i]) );
+    }
+
+    pthread_mutex_lock(&done->lock);
+    while (done->n_done < n_transfers)
+        pthread_cond_wait(&done->cond, &done->lock);
+    pthread_mutex_unlock(&done->lock);
+
+    for (int i = 0; i < n_transfers; i++)
+        wtime = (done->wtime[i] > wtime) ? done->wtime[i] : wtime;
+
+    pthread_cond_destroy(&done->cond);
+    pthread_mutex_destroy(&done->lock);
+    free(done->wtime);
+    free(done);
+    free(args);
+
+    return wtime;
+}
+
+/* State of a run, released even when a HIP error aborts it */
+typedef struct Run
+{
+    Hits_t             *hits;
+    bool                is_cold;        /* Rotate over the working set           */
+    int                 e;              /* Engine of the statistics (-1 if none) */
+    int                 alone;          /* Transfer run alone (-1 for all)       */
+    bool                is_transfering; /* Read by the heartbeat and QoS threads */
+    bool                is_heartbeat;   /* Heartbeat thread started              */
+    bool                is_qos;         /* QoS probe thread started              */
+    pthread_t           heartbeat;
+    pthread_t           qos;
+    CpuSample_t        *cpu_before;
+    CpuSample_t        *cpu_after;
+    DramCounters_t     *counters;
+    double             *wtime_anchor;   /* Host time of the trace anchors        */
+} Run_t;
+
+/**
+ * Stop the heartbeat and QoS probe threads of a run
+ *
+ * @param   run[inout]  Run
+ */
+static void run_stop_threads(Run_t *run)
+{
+    run->is_transfering = false;
+
+    if (run->is_qos)
+        pthread_join(run->qos, NULL);
+
+    if (run->is_heartbeat)
+        pthread_join(run->heartbeat, NULL);
+
+    run->is_qos       = false;
+    run->is_heartbeat = false;
+}
+
+static void _run_transfers(void *arg)
+{
+    Run_t *run = (Run_t *)arg;
+    Hits_t *hits = run->hits;
+    const bool is_cold = run->is_cold;
+    const int e = run->e;
+    const int first = (run->alone >= 0) ? run->alone : 0;
+    const int last = (run->alone >= 0) ? run->alone + 1 : hits->n_transfers;
+    const bool is_verbose = hits->is_verbose && run->alone < 0;
+    const bool is_qos = hits->qos.device >= 0 && run->alone < 0;
+    const size_t n_iter = hits->n_iter;
+    const size_t n_windows = (hits->working_set > 0) ? hits->working_set / hits->n_size : 1;
+    CpuStats_t *cpu = (e >= 0) ? &hits->cpu[e] : NULL;
+    DramStats_t *dram = (e >= 0) ? &hits->dram[e] : NULL;
+    NumaSample_t numa_before, numa_after;
+
+    for (int i = first; i < last; i++)
+    {
+        hits->transfer[i].is_started = false;
+        hits->transfer[i].n_faults   = 0;
+
+        if (is_verbose && !is_cold)
+            print_launch(hits, &hits->transfer[i]);
+    }
+
+    /* Starting heartbeat thread */
+    run->is_transfering = true;
+    if (is_verbose)
+    {
+        pthread_create(&run->heartbeat, NULL, &heart_beat, &run->is_transfering);
+        run->is_heartbeat = true;
+    }
+
+    /* Probe latency during the whole transfer window */
+    if (is_qos)
+    {
+        hits->qos.is_running = &run->is_transfering;
+        hits->qos.loaded[0].n = 0;
+        hits->qos.loaded[1].n = 0;
+        hits->qos.status = 0;
+        pthread_create(&run->qos, NULL, &_qos_worker, &hits->qos);
+        run->is_qos = true;
+    }
+
+    if (cpu != NULL)
+    {
+        run->cpu_before = (CpuSample_t *)malloc(sizeof(CpuSample_t));
+        run->cpu_after  = (CpuSample_t *)malloc(sizeof(CpuSample_t));
+        assert(run->cpu_before != NULL && run->cpu_after != NULL);
+        cpu_sample(run->cpu_before);
+        numa_sample(&numa_before);
+    }
+
+    if (dram != NULL && hits->is_dram_counters)
+    {
+        run->counters = (DramCounters_t *)malloc(sizeof(DramCounters_t));
+        assert(run->counters != NULL);
+        dram_open(run->counters);
+    }
+
+    if (hits->is_trace && run->alone < 0)
+    {
+        run->wtime_anchor = (double *)malloc(sizeof(double) * hits->n_transfers);
+        assert(run->wtime_anchor != NULL);
+        trace_anchor(hits, run->wtime_anchor);
+    }
+
+    /* Start all transfers at the same time */
+    const double wtime_launch = _wtime();
+    for (size_t i = 0; i < n_iter; i++)
+    {
+        const bool is_last = (i == n_iter - 1);
+        const size_t offset = is_cold ? (i % n_windows) * hits->n_size : 0;
+        for (int j = first; j < last; j++)
+        {
+            Transfer_t *t = &hits->transfer[j];
+            launch_transfer(hits, t, offset, is_last);
+
+            if (run->wtime_anchor != NULL)
+                checkHip( hipEventRecord(t->trace_events[i + 1], t->stream) );
+        }
+    }
+
+    const double wtime_done = wait_transfers(hits, first, last);
+
+    if (run->counters != NULL)
+        dram_close(run->counters, dram);
+
+    if (cpu != NULL)
+    {
+        cpu_sample(run->cpu_after);
+        numa_sample(&numa_after);
+        cpu_account(hits, run->cpu_before, run->cpu_after, cpu);
+        numa_account(&numa_before, &numa_after, &hits->numa[e]);
+    }
+
+    const bool is_heartbeat = run->is_heartbeat;
+    run_stop_threads(run);
+
+    if (is_heartbeat)
+        printf("\nCompleted.\n");
+
+    if (is_qos && hits->qos.status != 0)
+        hits_abort(hits->qos.status);
+
+    for (int i = first; i < last; i++)
+    {
+        Transfer_t *t = &hits->transfer[i];
+        checkHip( hipSetDevice(t->device) );
+        checkHip( hipEventElapsedTime(&t->dt_msec, t->start, t->stop) );
+    }
+
+    if (run->wtime_anchor != NULL)
+        trace_collect(hits, run->wtime_anchor, is_cold);
+
+    /* Transfers start as soon as launched, the rest is detection delay */
+    if (cpu != NULL)
+    {
+        float dt_msec_max = 0;
+        for (int i = first; i < last; i++)
+            dt_msec_max = (hits->transfer[i].dt_msec > dt_msec_max) ?
+                          hits->transfer[i].dt_msec : dt_msec_max;
+
+        cpu->wait_usec = (wtime_done - wtime_launch) * 1E6 - dt_msec_max * 1E3;
+    }
+}
+
+/**
+ * Launch all iterations of all transfers at the same time and wait for their
+ * completion. The duration of each transfer is stored in the transfer. On
+ * errors, threads are stopped and buffers released before the API call
+ * returns.
+ *
+ * @param   hits[inout]  Main application structure
+ * @param   is_cold[in]  Rotate the copied window over the working set
+ * @param   e[in]        Index of the engine whose host statistics (CPU cost,
+ *                       NUMA statistics, DRAM traffic) are collected, -1 for none
+ * @param   alone[in]    Index of a transfer run alone, without output, trace
+ *                       nor QoS probe (link probes), -1 to run all transfers
+ */
+static void run_transfers(Hits_t *hits, const bool is_cold, const int e, const int alone)
+{
+    Run_t run;
+    memset(&run, 0, sizeof(run));
+    run.hits    = hits;
+    run.is_cold = is_cold;
+    run.e       = e;
+    run.alone   = alone;
+
+    const int ret = _hits_catch(&_run_transfers, &run);
+
+    run_stop_threads(&run);
+
+    if (run.counters != NULL)
+    {
+        dram_close(run.counters, NULL);
+        free(run.counters);
+    }
+
+    free(run.cpu_before);
+    free(run.cpu_after);
+    free(run.wtime_anchor);
+
+    if (ret != 0)
+        hits_abort(ret);
+}
+
+/**
+ * Print the share of the theoretical link bandwidth reached by a transfer
+ *
+ * @param   t[in]       Transfer
+ * @param   gbps[in]    Measured bandwidth in GB/s
+ */
+static void print_efficiency(const Transfer_t *t, const double gbps)
+{
+    if (t->peak_gbps > 0)
+        printf(" - %.1f%% of %.2f GB/s (%s)", 100 * gbps / t->peak_gbps, t->peak_gbps, t->link);
+
+    if (t->link_speed > 0)
+        printf(" - link trained down to %.1f GT/s x%d", t->link_speed, t->link_width);
+}
+
+/**
+ * Print bandwidth results of the last run
+ *
+ * @param   hits[in]  Main application structure
+ */
+void hits_print_results(const Hits_t *hits)
+{
+    const size_t n_iter = hits->n_iter;
+    const double n_gbytes = (double)hits->n_size / 1E9;
+    const Shape_t *shape = &hits->shape;
+    const double n_payload_gbytes = (double)(shape->width * shape->height * shape->depth) / 1E9;
+
+    if (hits->working_set > 0)
+        printf("Hot runs copy the same window at each iteration, cold runs rotate over the "
+               "working set.\n");
+
+    if (shape->height > 0)
+        printf("Strided copies of %zu x %zu x %zu bytes (pitch %zu bytes): payload bandwidth "
+               "and bandwidth of the whole pitched area are reported.\n",
+               shape->width, shape->height, shape->depth, shape->pitch);
+
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        const Transfer_t *t = &hits->transfer[i];
+        const float dt_sec = t->dt_msec / 1E3;
+
+        if (t->type == DTOD)
+            printf("Transfer %d - %s from Device %d (%x:%02x) to Device %d (%x:%02x):", i,
+                   (t->engine == ENGINE_KERNEL) ? "P2P kernel copies" : "P2P transfers",
+                   t->device2, t->prop_device2.pciDomainID, t->prop_device2.pciBusID,
+		   t->device, t->prop_device.pciDomainID, t->prop_device.pciBusID);
+        else if (t->type == MANAGED)
+        {
+            /* Each iteration migrates the buffer to the device and back */
+            printf("Transfer %d - Managed memory migrations (%s) with Device %d (%x:%02x): "
+                   "%.3f GB/s  (%.2f seconds)", i, hits->is_demand_fault ? "prefetch + host faults"
+                   : "prefetch", t->device, t->prop_device.pciDomainID, t->prop_device.pciBusID,
+                   2 * n_gbytes / dt_sec * n_iter, dt_sec);
+            print_efficiency(t, 2 * n_gbytes / dt_sec * n_iter);
+
+            if (hits->is_demand_fault)
+                printf(" - %lu host page faults (%.1f per iteration)", (unsigned long)t->n_faults,
+                       (double)t->n_faults / n_iter);
+
+            printf("\n");
+            continue;
+        }
+        else
+            printf("Transfer %d - %s (%s) with Device %d (%x:%02x):", i,
+                   (t->engine == ENGINE_KERNEL) ? "Zero-copy kernel" : "Direct transfers",
+		   ttype_str[t->type], t->device, t->prop_device.pciDomainID,
+		   t->prop_device.pciBusID);
+
+        if (shape->height > 0)
+            printf(" %.3f GB/s payload, %.3f GB/s pitched  (%.2f seconds)",
+                   n_payload_gbytes / dt_sec * n_iter, n_gbytes / dt_sec * n_iter, dt_sec);
+        else
+            printf(" %.3f GB/s  (%.2f seconds)", n_gbytes / dt_sec * n_iter, dt_sec);
+
+        print_efficiency(t, n_gbytes / dt_sec * n_iter);
+        printf("\n");
+
+        if (hits->working_set == 0)
+            continue;
+
+        /* Same copies, each iteration on another window of the working set */
+        const float dt_cold_sec = t->dt_msec_cold / 1E3;
+        printf("    cold (%zu bytes working set):", hits->working_set);
+        if (shape->height > 0)
+            printf(" %.3f GB/s payload, %.3f GB/s pitched  (%.2f seconds)",
+                   n_payload_gbytes / dt_cold_sec * n_iter, n_gbytes / dt_cold_sec * n_iter,
+                   dt_cold_sec);
+        else
+            printf(" %.3f GB/s  (%.2f seconds)", n_gbytes / dt_cold_sec * n_iter, dt_cold_sec);
+
+        print_efficiency(t, n_gbytes / dt_cold_sec * n_iter);
+        printf("\n");
+    }
+}
+
+/**
+ * Print bandwidth of each transfer with every compared engine side by side
+ *
+ * @param   hits[in]  Main application structure
+ */
+void hits_print_engine_comparison(const Hits_t *hits)
+{
+    const double n_gbytes = (double)hits->n_size / 1E9 * hits->n_iter;
+    const char *sdma = getenv("HSA_ENABLE_SDMA");
+
+    printf("\nEngine comparison (GB/s, ratio to %s)", engine_str[hits->engines[0]]);
+    for (int e = 0; e < hits->n_engines; e++)
+        if (hits->engines[e] == ENGINE_AUTO)
+            printf(" - auto with HSA_ENABLE_SDMA=%s", (sdma != NULL) ? sdma : "<unset>");
+    printf(":\n");
+
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        const Transfer_t *t = &hits->transfer[i];
+
+        /* Managed memory is always migrated by prefetches or faults */
+        if (t->type == MANAGED)
+            continue;
+
+        printf("Transfer %d - %s with Device %d (%x:%02x):", i, ttype_str[t->type], t->device,
+               t->prop_device.pciDomainID, t->prop_device.pciBusID);
+
+        for (int e = 0; e < hits->n_engines; e++)
+        {
+            const double gbps = n_gbytes / (t->dt_msec_engine[e] / 1E3);
+            printf("  %s %.3f", engine_str[hits->engines[e]], gbps);
+            if (e > 0)
+                printf(" (%.2fx)", t->dt_msec_engine[0] / t->dt_msec_engine[e]);
+        }
+
+        printf("\n");
+    }
+}
+
+/**
+ * Build the result of a transfer for one of the compared engines
+ *
+ * @param   hits[in]    Main application structure
+ * @param   t[in]       Transfer
+ * @param   e[in]       Index of the engine in the compared engines
+ * @param   r[out]      Result
+ */
+static void get_result(const Hits_t *hits, const Transfer_t *t, const int e, Result_t *r)
+{
+    const Shape_t *shape = &hits->shape;
+    size_t n_moved = hits->n_size;
+
+    if (shape->height > 0)
+        n_moved = shape->width * shape->height * shape->depth;
+    else if (t->type == MANAGED)
+        n_moved = 2 * hits->n_size;
+
+    snprintf(r->type, sizeof(r->type), "%s", ttype_key[t->type]);
+    snprintf(r->engine, sizeof(r->engine), "%s", engine_str[hits->engines[e]]);
+    snprintf(r->bdf, sizeof(r->bdf), "%04x:%02x:%02x.0", t->prop_device.pciDomainID,
+             t->prop_device.pciBusID, t->prop_device.pciDeviceID);
+
+    if (t->type == DTOD)
+        snprintf(r->peer_bdf, sizeof(r->peer_bdf), "%04x:%02x:%02x.0", t->prop_device2.pciDomainID,
+                 t->prop_device2.pciBusID, t->prop_device2.pciDeviceID);
+    else
+        snprintf(r->peer_bdf, sizeof(r->peer_bdf), "-");
+
+    r->n_bytes = hits->n_size;
+    r->n_iter  = hits->n_iter;
+    r->seconds = t->dt_msec_engine[e] / 1E3;
+    r->gbps    = (double)n_moved * hits->n_iter / 1E9 / r->seconds;
+    r->gbps_cold = (hits->working_set > 0) ?
+                   (double)n_moved * hits->n_iter / 1E9 / (t->dt_msec_cold_engine[e] / 1E3) : 0;
+    r->n_corrupted = hits->is_verify ? t->n_corrupted[e] : -1;
+    host_alloc_str(hits, t, r->host_alloc, sizeof(r->host_alloc));
+    r->peak_gbps = t->peak_gbps;
+    r->efficiency = (t->peak_gbps > 0) ? 100 * r->gbps / t->peak_gbps : 0;
+    r->is_link_down = t->is_link_down[e];
+    r->cpu_sec_per_gb = (hits->cpu[e].n_gbytes > 0) ?
+                        (hits->cpu[e].user + hits->cpu[e].sys) / hits->cpu[e].n_gbytes : 0;
+    r->is_used = false;
+}
+
+int hits_get_results(const Hits_t *hits, Result_t *results, const int n_max)
+{
+    int n = 0;
+
+    for (int e = 0; e < hits->n_engines; e++)
+        for (int i = 0; i < hits->n_transfers; i++, n++)
+            if (results != NULL && n < n_max)
+                get_result(hits, &hits->transfer[i], e, &results[n]);
+
+    return n;
+}
+
+/**
+ * Write all results to a CSV file
+ *
+ * @param   hits[in]  Main application structure
+ * @param   path[in]  Result file
+ * @return  0 on success, 1 if the file cannot be written
+ */
+int hits_write_results(const Hits_t *hits, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: cannot open result file %s.\n", path);
+        return 1;
+    }
+
+    fprintf(file, "# %s\n", HITS_VERSION);
+    fprintf(file, "type,engine,bdf,peer_bdf,size,iterations,seconds,gbps,host_alloc,peak_gbps,"
+                  "efficiency\n");
+
+    for (int e = 0; e < hits->n_engines; e++)
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            Result_t r;
+            get_result(hits, &hits->transfer[i], e, &r);
+            fprintf(file, "%s,%s,%s,%s,%zu,%ld,%.6f,%.6f,%s,%.6f,%.3f\n", r.type, r.engine, r.bdf,
+                    r.peer_bdf, r.n_bytes, r.n_iter, r.seconds, r.gbps, r.host_alloc, r.peak_gbps,
+                    r.efficiency);
+        }
+
+    fclose(file);
+    return 0;
+}
+
+/* One JSON object on a single line, so that stream readers can split replies */
+void hits_print_json(const Hits_t *hits, FILE *file)
+{
+    fprintf(file, "{\"version\":\"%s\",\"iterations\":%ld,\"size\":%ld,\"wait\":\"%s\","
+                  "\"results\":[", HITS_VERSION, hits->n_iter, hits->n_size, wait_str[hits->wait]);
+
+    for (int e = 0; e < hits->n_engines; e++)
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            Result_t r;
+            get_result(hits, &hits->transfer[i], e, &r);
+            fprintf(file, "%s{\"type\":\"%s\",\"engine\":\"%s\",\"bdf\":\"%s\","
+                          "\"peer_bdf\":\"%s\",\"size\":%zu,\"iterations\":%ld,"
+                          "\"seconds\":%.6f,\"gbps\":%.6f,\"gbps_cold\":%.6f,"
+                          "\"corrupted\":%ld,\"host_alloc\":\"%s\",\"cpu_sec_per_gb\":%.6f,"
+                          "\"peak_gbps\":%.6f,\"efficiency\":%.3f,\"link_down\":%s}",
+                    (e + i > 0) ? "," : "", r.type, r.engine, r.bdf, r.peer_bdf, r.n_bytes,
+                    r.n_iter, r.seconds, r.gbps, r.gbps_cold, r.n_corrupted, r.host_alloc,
+                    r.cpu_sec_per_gb, r.peak_gbps, r.efficiency,
+                    r.is_link_down ? "true" : "false");
+        }
+
+    fprintf(file, "]}\n");
+}
+
+int hits_write_trace(const Hits_t *hits, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: cannot open trace file %s.\n", path);
+        return 1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+                  "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+                  "\"args\":{\"name\":\"%s\"}}", HITS_VERSION);
+
+    /* One track per transfer, each transfer has its own stream */
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        const Transfer_t *t = &hits->transfer[i];
+        char peer[32] = "";
+
+        if (t->type == DTOD)
+            snprintf(peer, sizeof(peer), " from Device %d", t->device2);
+
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+                      "\"args\":{\"name\":\"Transfer %d - %s - Device %d%s - %s priority\"}}",
+                i, i, ttype_str[t->type], t->device, peer, priority_str[t->priority]);
+    }
+
+    for (size_t k = 0; k < hits->n_trace; k++)
+    {
+        const TraceSpan_t *span = &hits->trace[k];
+        const Transfer_t *t = &hits->transfer[span->transfer];
+
+        fprintf(file, ",\n{\"name\":\"%s %s%s\",\"cat\":\"copy\",\"ph\":\"X\",\"pid\":0,"
+                      "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"iteration\":%ld,"
+                      "\"engine\":\"%s\",\"cold\":%s,\"bytes\":%ld}}", ttype_key[t->type],
+                engine_str[span->engine], span->is_cold ? " cold" : "", span->transfer,
+                span->begin_usec, span->end_usec - span->begin_usec, span->iter,
+                engine_str[span->engine], span->is_cold ? "true" : "false", hits->n_size);
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return 0;
+}
+
+/**
+ * Write the quantiles of a sample set as a Prometheus summary
+ *
+ * @param   file[in]    Output file
+ * @param   name[in]    Metric name
+ * @param   labels[in]  Labels shared by the series, without braces
+ * @param   lat[in]     Samples in microseconds
+ */
+static void prometheus_summary(FILE *file, const char *name, const char *labels, Latency_t *lat)
+{
+    static const double quantiles[3] = { 0.5, 0.9, 0.99 };
+    double sum = 0;
+
+    if (lat->n == 0)
+        return;
+
+    for (size_t k = 0; k < lat->n; k++)
+        sum += lat->usec[k];
+
+    for (int q = 0; q < 3; q++)
+        fprintf(file, "%s{%s,quantile=\"%g\"} %.9f\n", name, labels, quantiles[q],
+                _percentile(lat, quantiles[q] * 100) / 1E6);
+
+    fprintf(file, "%s_sum{%s} %.9f\n%s_count{%s} %zu\n", name, labels, sum / 1E6, name, labels,
+            lat->n);
+}
+
+int hits_write_prometheus(Hits_t *hits, const char *path)
+{
+    char tmp_path[PATH_MAX], labels[160];
+
+    /* The collector must never read a partly written file */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: cannot open metric file %s.\n", tmp_path);
+        return 1;
+    }
+
+    fprintf(file, "# HELP hits_probe_timestamp_seconds Time of the last probe.\n"
+                  "# TYPE hits_probe_timestamp_seconds gauge\n"
+                  "hits_probe_timestamp_seconds %ld\n", (long)time(NULL));
+
+    fprintf(file, "# HELP hits_bandwidth_gbps Bandwidth of each transfer during the last "
+                  "probe in GB/s.\n# TYPE hits_bandwidth_gbps gauge\n");
+    for (int e = 0; e < hits->n_engines; e++)
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            Result_t r;
+            get_result(hits, &hits->transfer[i], e, &r);
+            fprintf(file, "hits_bandwidth_gbps{bdf=\"%s\",peer_bdf=\"%s\",direction=\"%s\","
+                          "engine=\"%s\"} %.6f\n", r.bdf, r.peer_bdf, r.type, r.engine, r.gbps);
+        }
+
+    fprintf(file, "# HELP hits_efficiency_ratio Bandwidth of each transfer over the theoretical "
+                  "bandwidth of its link.\n# TYPE hits_efficiency_ratio gauge\n");
+    for (int e = 0; e < hits->n_engines; e++)
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            Result_t r;
+            get_result(hits, &hits->transfer[i], e, &r);
+            if (r.peak_gbps > 0)
+                fprintf(file, "hits_efficiency_ratio{bdf=\"%s\",peer_bdf=\"%s\",direction=\"%s\","
+                              "engine=\"%s\"} %.4f\n", r.bdf, r.peer_bdf, r.type, r.engine,
+                        r.efficiency / 100);
+        }
+
+    /* Durations of the copies of each transfer, from the trace of the probe */
+    if (hits->n_trace > 0)
+    {
+        Latency_t lat;
+        lat.usec = (double *)malloc(sizeof(double) * hits->n_iter);
+        assert(lat.usec != NULL);
+
+        fprintf(file, "# HELP hits_copy_seconds Duration of each copy during the last probe.\n"
+                      "# TYPE hits_copy_seconds summary\n");
+        for (int e = 0; e < hits->n_engines; e++)
+            for (int i = 0; i < hits->n_transfers; i++)
+            {
+                Result_t r;
+                get_result(hits, &hits->transfer[i], e, &r);
+
+                lat.n = 0;
+                for (size_t k = 0; k < hits->n_trace && lat.n < (size_t)hits->n_iter; k++)
+                {
+                    const TraceSpan_t *span = &hits->trace[k];
+                    if (span->transfer == i && span->engine == hits->engines[e] &&
+                        !span->is_cold)
+                        lat.usec[lat.n++] = span->end_usec - span->begin_usec;
+                }
+
+                snprintf(labels, sizeof(labels), "bdf=\"%s\",peer_bdf=\"%s\",direction=\"%s\","
+                         "engine=\"%s\"", r.bdf, r.peer_bdf, r.type, r.engine);
+                prometheus_summary(file, "hits_copy_seconds", labels, &lat);
+            }
+
+        free(lat.usec);
+    }
+
+    if (hits->qos.device >= 0)
+    {
+        struct hipDeviceProp_t prop;
+        char bdf[32] = "-";
+
+        if (hipGetDeviceProperties(&prop, hits->qos.device) == hipSuccess)
+            snprintf(bdf, sizeof(bdf), "%04x:%02x:%02x.0", prop.pciDomainID, prop.pciBusID,
+                     prop.pciDeviceID);
+
+        fprintf(file, "# HELP hits_qos_latency_seconds Latency of small probe copies while the "
+                      "transfers ran.\n# TYPE hits_qos_latency_seconds summary\n");
+        for (int p = 0; p < 2; p++)
+        {
+            snprintf(labels, sizeof(labels), "bdf=\"%s\",direction=\"htod\",priority=\"%s\"",
+                     bdf, (p == 1) ? "high" : "normal");
+            prometheus_summary(file, "hits_qos_latency_seconds", labels, &hits->qos.loaded[p]);
+        }
+    }
+
+    fprintf(file, "# HELP hits_host_pages_ratio Share of the host buffer pages on each NUMA "
+                  "node.\n# TYPE hits_host_pages_ratio gauge\n");
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        Result_t r;
+        get_result(hits, &hits->transfer[i], 0, &r);
+
+        for (int n = 0; n < CPU_NODES_MAX; n++)
+            if (hits->transfer[i].host_pages[n] > 0)
+                fprintf(file, "hits_host_pages_ratio{bdf=\"%s\",direction=\"%s\",node=\"%d\"} "
+                              "%.4f\n", r.bdf, r.type, n, hits->transfer[i].host_pages[n] / 100);
+    }
+
+    fprintf(file, "# HELP hits_host_pages_local_ratio Share of the populated host buffer pages "
+                  "on the node local to the GPU.\n# TYPE hits_host_pages_local_ratio gauge\n");
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        const Transfer_t *t = &hits->transfer[i];
+        const int local = gpu_numa_node(&t->prop_device);
+        const double populated = 100 - t->host_pages_absent;
+        Result_t r;
+
+        if ((t->type != DTOH && t->type != HTOD) || local < 0 || local >= CPU_NODES_MAX ||
+            populated <= 0)
+            continue;
+
+        get_result(hits, t, 0, &r);
+        fprintf(file, "hits_host_pages_local_ratio{bdf=\"%s\",direction=\"%s\"} %.4f\n",
+                r.bdf, r.type, t->host_pages[local] / populated);
+    }
+
+    if (fclose(file) != 0 || rename(tmp_path, path) != 0)
+    {
+        fprintf(stderr, "Error: cannot write metric file %s (%s).\n", path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Load results written by write_results
+ *
+ * @param   path[in]         Result file
+ * @param   n_results[out]   Amount of results
+ * @return  Array of results (to free), NULL if the file cannot be read
+ */
+static Result_t* load_results(const char *path, int *n_results)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: cannot open baseline file %s.\n", path);
+        return NULL;
+    }
+
+    int n_alloc = 16;
+    Result_t *results = (Result_t *)malloc(sizeof(Result_t) * n_alloc);
+    char line[512];
+    assert(results != NULL);
+
+    *n_results = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        Result_t *r = &results[*n_results];
+
+        /* Skip comments and header */
+        if (line[0] == '#' || strncmp(line, "type,", 5) == 0)
+            continue;
+
+        /* Files written before host_alloc was recorded have 8 columns, later columns (peak
+           bandwidth, efficiency) are not compared */
+        snprintf(r->host_alloc, sizeof(r->host_alloc), "-");
+        if (sscanf(line, "%15[^,],%15[^,],%15[^,],%15[^,],%zu,%ld,%lf,%lf,%47[^,\n]", r->type,
+                   r->engine, r->bdf, r->peer_bdf, &r->n_bytes, &r->n_iter, &r->seconds,
+                   &r->gbps, r->host_alloc) < 8)
+        {
+            fprintf(stderr, "Error: malformed line in baseline file %s: %s", path, line);
+            free(results);
+            fclose(file);
+            return NULL;
+        }
+
+        r->is_used = false;
+        if (++(*n_results) == n_alloc)
+        {
+            n_alloc *= 2;
+            results = (Result_t *)realloc(results, sizeof(Result_t) * n_alloc);
+            assert(results != NULL);
+        }
+    }
+
+    fclose(file);
+    return results;
+}
+
+/* Each baseline entry matches at most one transfer so that duplicated
+   transfers are compared in order. */
+int hits_check_baseline(const Hits_t *hits, const char *path, const double tolerance)
+{
+    int n_base, n_regressions = 0;
+    Result_t *base = load_results(path, &n_base);
+    if (base == NULL)
+        return -1;
+
+    printf("\nComparison with baseline %s (tolerance %.1f%%):\n", path, tolerance);
+
+    for (int e = 0; e < hits->n_engines; e++)
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            Result_t r;
+            Result_t *b = NULL;
+            get_result(hits, &hits->transfer[i], e, &r);
+
+            for (int k = 0; k < n_base && b == NULL; k++)
+                if (!base[k].is_used && base[k].n_bytes == r.n_bytes &&
+                    strcmp(base[k].type, r.type) == 0 && strcmp(base[k].engine, r.engine) == 0 &&
+                    strcmp(base[k].bdf, r.bdf) == 0 && strcmp(base[k].peer_bdf, r.peer_bdf) == 0)
+                    b = &base[k];
+
+            printf("Transfer %d - %s (%s", i, ttype_str[hits->transfer[i].type], r.bdf);
+            if (hits->transfer[i].type == DTOD)
+                printf(" from %s", r.peer_bdf);
+            printf(") - Engine: %s: %.3f GB/s", r.engine, r.gbps);
+
+            if (b == NULL)
+            {
+                printf(" - no baseline\n");
+                continue;
+            }
+
+            b->is_used = true;
+            const double delta = (r.gbps - b->gbps) / b->gbps * 100;
+            const bool is_regression = (delta < -tolerance);
+            n_regressions += is_regression;
+
+            printf(" vs %.3f GB/s (%+.1f%%)%s\n", b->gbps, delta,
+                   is_regression ? " - REGRESSION" : "");
+        }
+
+    free(base);
+    return n_regressions;
+}
+
+/* Allocation paths measured by the allocation benchmark */
+typedef enum AllocPath
+{
+    ALLOC_HOST_MALLOC = 0,  /* hipHostMalloc / hipHostFree                   */
+    ALLOC_HOST_REGISTER,    /* hipHostRegister / hipHostUnregister           */
+    ALLOC_NUMA,             /* numa_alloc_onnode + first touch / numa_free   */
+    ALLOC_DEVICE,           /* hipMalloc / hipFree                           */
+    ALLOC_PATH_COUNT,
+} AllocPath_t;
+
+static const char * const alloc_path_str[] =
+{
+    "hipHostMalloc",
+    "hipHostRegister",
+    "numa_alloc_onnode+touch",
+    "hipMalloc",
+};
+
+/**
+ * Time allocations and frees of one path, one buffer at a time. Device
+ * buffers are allocated on the current device.
+ *
+ * @param   path[in]       Allocation path
+ * @param   numa_node[in]  NUMA node of host buffers (-1 if not aware)
+ * @param   n_bytes[in]    Buffer size
+ * @param   n_reps[in]     Amount of allocations
+ * @param   dt_sec[out]    Allocation and free durations of all repetitions
+ */
+static void alloc_bench_path(const AllocPath_t path, const int numa_node, const size_t n_bytes,
+                             const long n_reps, double dt_sec[2])
+{
+    dt_sec[0] = dt_sec[1] = 0;
+
+    for (long r = 0; r < n_reps; r++)
+    {
+        void *ptr = NULL;
+        double t_start;
+
+        /* Registration is timed on memory that is already resident */
+        if (path == ALLOC_HOST_REGISTER)
+        {
+            ptr = (numa_node >= 0) ? numa_alloc_onnode(n_bytes, numa_node) : numa_alloc_local(n_bytes);
+            assert(ptr != NULL);
+            memset(ptr, 0, n_bytes);
+        }
+
+        t_start = _wtime();
+        switch (path)
+        {
+            case ALLOC_HOST_MALLOC:
+                checkHip( hipHostMalloc(&ptr, n_bytes, hipHostMallocDefault |
+                                        ((numa_node >= 0) ? hipHostMallocNumaUser : 0)) );
+                break;
+            case ALLOC_HOST_REGISTER:
+                checkHip( hipHostRegister(ptr, n_bytes, hipHostRegisterDefault) );
+                break;
+            case ALLOC_NUMA:
+                ptr = (numa_node >= 0) ? numa_alloc_onnode(n_bytes, numa_node) : numa_alloc_local(n_bytes);
+                assert(ptr != NULL);
+                memset(ptr, 0, n_bytes);
+                break;
+            default:
+                checkHip( hipMalloc(&ptr, n_bytes) );
+                break;
+        }
+        dt_sec[0] += _wtime() - t_start;
+
+        t_start = _wtime();
+        switch (path)
+        {
+            case ALLOC_HOST_MALLOC:
+                checkHip( hipHostFree(ptr) );
+                break;
+            case ALLOC_HOST_REGISTER:
+                checkHip( hipHostUnregister(ptr) );
+                break;
+            case ALLOC_NUMA:
+                numa_free(ptr, n_bytes);
+                break;
+            default:
+                checkHip( hipFree(ptr) );
+                break;
+        }
+        dt_sec[1] += _wtime() - t_start;
+
+        if (path == ALLOC_HOST_REGISTER)
+            numa_free(ptr, n_bytes);
+    }
+}
+
+/**
+ * Print one line of the allocation benchmark
+ *
+ * @param   path[in]       Allocation path
+ * @param   numa_node[in]  NUMA node of host buffers (-1 if not applicable)
+ * @param   n_bytes[in]    Buffer size
+ * @param   n_reps[in]     Amount of allocations
+ * @param   dt_sec[in]     Allocation and free durations of all repetitions
+ */
+static void print_alloc_bench(const AllocPath_t path, const int numa_node, const size_t n_bytes,
+                              const long n_reps, const double dt_sec[2])
+{
+    const double n_gib = (double)n_bytes * n_reps / (1 << 30);
+    char node[16];
+
+    snprintf(node, sizeof(node), (numa_node >= 0) ? "%d" : "-", numa_node);
+    printf("  %-24s %4s %12zu %12.3f %12.1f %12.3f %12.1f\n", alloc_path_str[path], node, n_bytes,
+           dt_sec[0] * 1E3 / n_gib, n_reps / dt_sec[0], dt_sec[1] * 1E3 / n_gib,
+           n_reps / dt_sec[1]);
+}
+
+static void _alloc_bench(Hits_t *hits)
+{
+    const int max_node = (numa_available() >= 0) ? numa_max_node() : -1;
+    int devices[ALLOC_BENCH_MAX_DEVICES];
+    int n_devices = 0;
+
+    if (hits->n_transfers == 0)
+    {
+        fprintf(stderr, "Error: the plan does not contain any transfer.\n");
+        hits_abort(1);
+    }
+
+    /* Each GPU involved in the plan is measured once */
+    for (int i = 0; i < hits->n_transfers; i++)
+        for (int k = 0; k < 2; k++)
+        {
+            const int device = (k == 0) ? hits->transfer[i].device : hits->transfer[i].device2;
+            bool is_known = (device < 0);
+
+            for (int d = 0; d < n_devices && !is_known; d++)
+                is_known = (devices[d] == device);
+
+            if (!is_known && n_devices < (int)(sizeof(devices) / sizeof(int)))
+                devices[n_devices++] = device;
+        }
+
+    for (int d = 0; d < n_devices; d++)
+    {
+        struct hipDeviceProp_t prop;
+        checkHip( hipGetDeviceProperties(&prop, devices[d]) );
+        checkHip( hipSetDevice(devices[d]) );
+
+        printf("Allocation benchmark with Device %d (%x:%02x) - up to %ld allocations of each "
+               "size (%d MiB at most per size):\n", devices[d], prop.pciDomainID, prop.pciBusID,
+               hits->n_iter, ALLOC_BENCH_BUDGET >> 20);
+        printf("  %-24s %4s %12s %12s %12s %12s %12s\n", "Path", "Node", "Bytes", "Alloc ms/GiB",
+               "Alloc/s", "Free ms/GiB", "Free/s");
+
+        for (size_t n_bytes = ALLOC_BENCH_SIZE_MIN; ; n_bytes *= ALLOC_BENCH_SIZE_STEP)
+        {
+            if (n_bytes > (size_t)hits->n_size)
+                n_bytes = hits->n_size;
+
+            long n_reps = ALLOC_BENCH_BUDGET / n_bytes;
+            n_reps = (n_reps > hits->n_iter) ? hits->n_iter : n_reps;
+            n_reps = (n_reps < 1) ? 1 : n_reps;
+
+            for (int p = 0; p < ALLOC_PATH_COUNT; p++)
+            {
+                double dt_sec[2];
+
+                if (p == ALLOC_DEVICE)
+                {
+                    alloc_bench_path((AllocPath_t)p, -1, n_bytes, n_reps, dt_sec);
+                    print_alloc_bench((AllocPath_t)p, -1, n_bytes, n_reps, dt_sec);
+                    continue;
+                }
+
+                for (int node = (max_node >= 0) ? 0 : -1; node <= max_node; node++)
+                {
+                    if (node >= 0 && !numa_bitmask_isbitset(numa_all_nodes_ptr, node))
+                        continue;
+
+                    /* hipHostMalloc places pages with the NUMA policy of the thread */
+                    if (node >= 0)
+                        numa_set_preferred(node);
+
+                    alloc_bench_path((AllocPath_t)p, node, n_bytes, n_reps, dt_sec);
+                    print_alloc_bench((AllocPath_t)p, node, n_bytes, n_reps, dt_sec);
+                }
+
+                if (max_node >= 0)
+                    numa_set_localalloc();
+            }
+
+            if (n_bytes == (size_t)hits->n_size)
+                break;
+        }
+    }
+}
+
+static void _offset_sweep(Hits_t *hits)
+{
+    const int n = hits->n_offsets;
+    float *dt_msec = (float *)malloc(sizeof(float) * n * n * hits->n_transfers);
+    assert(dt_msec != NULL);
+
+    if (!hits->is_setup || n == 0)
+    {
+        fprintf(stderr, "Error: the offset sweep requires a plan set up with offsets.\n");
+        free(dt_msec);
+        hits_abort(1);
+    }
+
+    for (int i = 0; i < hits->n_transfers; i++)
+        hits->transfer[i].engine = hits->engines[0];
+
+    /* Only the tables are printed */
+    const bool is_verbose = hits->is_verbose;
+    hits->n_trace = 0;
+    hits->is_verbose = false;
+
+    /* Untimed run, first copies pay for lazy initializations */
+    run_transfers(hits, false, -1, -1);
+
+    for (int so = 0; so < n; so++)
+        for (int d = 0; d < n; d++)
+        {
+            hits->src_offset  = hits->offsets[so];
+            hits->dest_offset = hits->offsets[d];
+            run_transfers(hits, false, -1, -1);
+
+            for (int i = 0; i < hits->n_transfers; i++)
+                dt_msec[(so * n + d) * hits->n_transfers + i] = hits->transfer[i].dt_msec;
+        }
+
+    hits->src_offset  = 0;
+    hits->dest_offset = 0;
+    hits->is_verbose  = is_verbose;
+
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        const Transfer_t *t = &hits->transfer[i];
+
+        /* Migrations prefetch whole pages, offsets do not apply */
+        if (t->type == MANAGED)
+            continue;
+
+        printf("\nOffset sweep - Transfer %d - %s with Device %d (%x:%02x) - Engine: %s - GB/s "
+               "(rows: source offset, columns: destination offset):\n", i, ttype_str[t->type],
+               t->device, t->prop_device.pciDomainID, t->prop_device.pciBusID,
+               engine_str[t->engine]);
+
+        printf("%10s", "");
+        for (int d = 0; d < n; d++)
+            printf(" %10zu", hits->offsets[d]);
+        printf("\n");
+
+        for (int so = 0; so < n; so++)
+        {
+            printf("%10zu", hits->offsets[so]);
+            for (int d = 0; d < n; d++)
+            {
+                const float dt_sec = dt_msec[(so * n + d) * hits->n_transfers + i] / 1E3;
+                printf(" %10.3f", (double)hits->n_size / 1E9 * hits->n_iter / dt_sec);
+            }
+            printf("\n");
+        }
+    }
+
+    free(dt_msec);
+}
+
+/* PCIe link of a device as reported by sysfs */
+typedef struct Link
+{
+    double      speed;          /* Current rate per lane in GT/s (0 if unknown) */
+    int         width;          /* Current amount of lanes (0 if unknown)       */
+    double      max_speed;      /* Maximum rate per lane in GT/s                */
+    int         max_width;      /* Maximum amount of lanes                      */
+} Link_t;
+
+/**
+ * Read the current and maximum PCIe link settings of a device
+ *
+ * @param   hits[in]    Main application structure (sysfs root)
+ * @param   prop[in]    Device properties
+ * @param   link[out]   Link settings
+ * @return  0 on success, -1 if sysfs does not describe the link
+ */
+static int read_link(const Hits_t *hits, const struct hipDeviceProp_t *prop, Link_t *link)
+{
+    static const char * const attrs[4] = { "current_link_speed", "current_link_width",
+                                           "max_link_speed", "max_link_width" };
+    double values[4];
+    char path[PATH_MAX], line[64];
+
+    for (int a = 0; a < 4; a++)
+    {
+        snprintf(path, sizeof(path), "%s/bus/pci/devices/%04x:%02x:%02x.0/%s",
+                 (hits->sysfs_root != NULL) ? hits->sysfs_root : "/sys", prop->pciDomainID,
+                 prop->pciBusID, prop->pciDeviceID, attrs[a]);
+
+        /* Speeds read "16.0 GT/s PCIe", widths "16", both may be "Unknown" */
+        if (read_sysfs_line(path, line, sizeof(line)) != 0)
+            return -1;
+        values[a] = strtod(line, NULL);
+    }
+
+    link->speed     = values[0];
+    link->width     = (int)values[1];
+    link->max_speed = values[2];
+    link->max_width = (int)values[3];
+    return 0;
+}
+
+/**
+ * Theoretical bandwidth of a PCIe link in one direction
+ *
+ * @param   speed[in]   Rate per lane in GT/s
+ * @param   width[in]   Amount of lanes
+ * @return  Bandwidth in GB/s
+ */
+static double link_gbps(const double speed, const int width)
+{
+    /* 8b/10b encoding up to 5 GT/s, 128b/130b from 8 GT/s, 242B/256B flits at 64 GT/s */
+    const double encoding = (speed <= 5.0) ? 0.8 : (speed < 64.0) ? 128.0 / 130 : 242.0 / 256;
+    return speed * encoding * width / 8;
+}
+
+/**
+ * Read the properties of a KFD topology node or link
+ *
+ * @param   path[in]    Properties file
+ * @param   keys[in]    Property names
+ * @param   values[out] Property values (unchanged if missing)
+ * @param   n_keys[in]  Amount of properties
+ * @return  0 on success, -1 if the file cannot be read
+ */
+static int read_kfd_properties(const char *path, const char * const *keys, long *values,
+                               const int n_keys)
+{
+    char key[64];
+    long value;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    while (fscanf(file, "%63s %ld", key, &value) == 2)
+        for (int k = 0; k < n_keys; k++)
+            if (strcmp(key, keys[k]) == 0)
+                values[k] = value;
+
+    fclose(file);
+    return 0;
+}
+
+/**
+ * KFD topology node of a GPU, matched by PCI location
+ *
+ * @param   hits[in]    Main application structure (sysfs root)
+ * @param   prop[in]    Device properties
+ * @return  Node id, -1 if not found
+ */
+static int kfd_node(const Hits_t *hits, const struct hipDeviceProp_t *prop)
+{
+    static const char * const keys[3] = { "simd_count", "location_id", "domain" };
+    const long location = (prop->pciBusID << 8) | (prop->pciDeviceID << 3);
+    char path[PATH_MAX];
+
+    for (int n = 0; ; n++)
+    {
+        long values[3] = { 0, -1, -1 };
+
+        snprintf(path, sizeof(path), "%s/class/kfd/kfd/topology/nodes/%d/properties",
+                 (hits->sysfs_root != NULL) ? hits->sysfs_root : "/sys", n);
+        if (read_kfd_properties(path, keys, values, 3) != 0)
+            return -1;
+
+        /* CPU nodes have no SIMD */
+        if (values[0] > 0 && values[1] == location && values[2] == prop->pciDomainID)
+            return n;
+    }
+}
+
+/**
+ * Theoretical bandwidth of the xGMI links between two GPUs from the KFD
+ * topology
+ *
+ * @param   hits[in]    Main application structure (sysfs root)
+ * @param   from[in]    Properties of the source device
+ * @param   to[in]      Properties of the destination device
+ * @return  Bandwidth in GB/s, 0 if the GPUs are not connected by xGMI
+ */
+static double xgmi_gbps(const Hits_t *hits, const struct hipDeviceProp_t *from,
+                        const struct hipDeviceProp_t *to)
+{
+    static const char * const keys[3] = { "type", "node_to", "max_bandwidth" };
+    const int node_from = kfd_node(hits, from), node_to = kfd_node(hits, to);
+    char path[PATH_MAX];
+    double gbps = 0;
+
+    if (node_from < 0 || node_to < 0)
+        return 0;
+
+    /* Links are listed from the source node, bandwidths in MB/s */
+    for (int l = 0; ; l++)
+    {
+        long values[3] = { 0, -1, 0 };
+
+        snprintf(path, sizeof(path), "%s/class/kfd/kfd/topology/nodes/%d/io_links/%d/properties",
+                 (hits->sysfs_root != NULL) ? hits->sysfs_root : "/sys", node_from, l);
+        if (read_kfd_properties(path, keys, values, 3) != 0)
+            break;
+
+        if (values[0] == KFD_IOLINK_XGMI && values[1] == node_to)
+            gbps += values[2] / 1E3;
+    }
+
+    return gbps;
+}
+
+/**
+ * Set the theoretical bandwidth of the link used by a transfer: the PCIe link
+ * of the GPU at its maximum settings for host transfers, the xGMI links
+ * between the GPUs (or the slowest PCIe link) for peer transfers. Idle GPUs
+ * lower their link speed, current settings are checked after runs instead.
+ *
+ * @param   hits[in]    Main application structure (sysfs root)
+ * @param   t[inout]    Transfer
+ */
+static void transfer_peak(const Hits_t *hits, Transfer_t *t)
+{
+    Link_t link, link2;
+
+    t->peak_gbps  = 0;
+    t->is_pcie    = false;
+    t->link_speed = 0;
+    t->link_width = 0;
+    memset(t->is_link_down, 0, sizeof(t->is_link_down));
+    snprintf(t->link, sizeof(t->link), "-");
+
+    if (t->type == DTOD)
+    {
+        t->peak_gbps = xgmi_gbps(hits, &t->prop_device2, &t->prop_device);
+        if (t->peak_gbps > 0)
+        {
+            snprintf(t->link, sizeof(t->link), "xGMI");
+            return;
+        }
+
+        if (read_link(hits, &t->prop_device, &link) != 0 ||
+            read_link(hits, &t->prop_device2, &link2) != 0)
+            return;
+
+        if (link_gbps(link2.max_speed, link2.max_width) <
+            link_gbps(link.max_speed, link.max_width))
+            link = link2;
+    }
+    else if (read_link(hits, &t->prop_device, &link) != 0)
+        return;
+
+    t->peak_gbps = link_gbps(link.max_speed, link.max_width);
+    t->is_pcie   = (t->peak_gbps > 0);
+    if (t->peak_gbps > 0)
+        snprintf(t->link, sizeof(t->link), "PCIe %.1f GT/s x%d", link.max_speed, link.max_width);
+}
+
+/**
+ * Check right after a run whether the PCIe links of a transfer ran below
+ * their maximum settings, before they train down while idle
+ *
+ * @param   hits[in]    Main application structure (sysfs root)
+ * @param   t[inout]    Transfer
+ * @param   e[in]       Index of the engine of the run
+ */
+static void transfer_link_check(const Hits_t *hits, Transfer_t *t, const int e)
+{
+    const struct hipDeviceProp_t *props[2] = { &t->prop_device, &t->prop_device2 };
+
+    t->link_speed      = 0;
+    t->link_width      = 0;
+    t->is_link_down[e] = false;
+
+    for (int l = 0; l < ((t->type == DTOD) ? 2 : 1) && t->is_pcie; l++)
+    {
+        Link_t link;
+        if (read_link(hits, props[l], &link) != 0 || link.speed <= 0 || link.width <= 0)
+            continue;
+
+        if (link.speed < link.max_speed || link.width < link.max_width)
+        {
+            t->link_speed      = link.speed;
+            t->link_width      = link.width;
+            t->is_link_down[e] = true;
+        }
+    }
+}
+
+static void _healthcheck(Hits_t *hits)
+{
+    if (!hits->is_setup)
+    {
+        fprintf(stderr, "Error: the plan must be set up before checking links.\n");
+        hits_abort(1);
+    }
+
+    hits->n_unhealthy = 0;
+
+    printf("Link health (minimum efficiency %.0f%%):\n", hits->health_min);
+
+    /* Each direction is probed alone, after an untimed warm-up */
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        Transfer_t *t = &hits->transfer[i];
+
+        printf("Transfer %d - %s with Device %d (%04x:%02x:%02x.0):", i, ttype_str[t->type],
+               t->device, t->prop_device.pciDomainID, t->prop_device.pciBusID,
+               t->prop_device.pciDeviceID);
+
+        if (t->type != DTOH && t->type != HTOD)
+        {
+            printf(" not a PCIe host transfer, not checked\n");
+            continue;
+        }
+
+        t->engine = hits->engines[0];
+        run_transfers(hits, false, -1, i);
+        run_transfers(hits, false, -1, i);
+
+        /* Links may train down while idle, check them right after the probe. Probes are
+           the results of the first engine, accounted as those of normal runs. */
+        transfer_link_check(hits, t, 0);
+        t->dt_msec_engine[0] = t->dt_msec;
+
+        if (!t->is_pcie)
+        {
+            printf(" link settings unavailable in sysfs - DEGRADED\n");
+            hits->n_unhealthy++;
+            continue;
+        }
+
+        Result_t r;
+        get_result(hits, t, 0, &r);
+
+        printf(" link %s (%.2f GB/s theoretical)", t->link, t->peak_gbps);
+        if (t->link_speed > 0)
+            printf(", trained down to %.1f GT/s x%d", t->link_speed, t->link_width);
+        printf(", %.2f GB/s measured (%.1f%%)", r.gbps, r.efficiency);
+
+        if (r.is_link_down || r.efficiency < hits->health_min)
+        {
+            printf(" - DEGRADED (%s)\n", r.is_link_down ? "link below its maximum" :
+                   "throughput below the minimum efficiency");
+            hits->n_unhealthy++;
+        }
+        else
+            printf(" - OK\n");
+    }
+}
+
+/**
+ * Check the plan settings before any allocation
+ *
+ * @param   hits[inout]  Main application structure
+ */
+/**
+ * Set HSA_ENABLE_SDMA for the sdma or blit engine run by this process. The
+ * runtime reads it once, at initialization, which must not have happened yet.
+ *
+ * @param   hits[in]  Main application structure
+ */
+static void check_sdma(const Hits_t *hits)
+{
+    const char *sdma = getenv("HSA_ENABLE_SDMA");
+    int engine = -1;
+
+    for (int e = 0; e < hits->n_engines; e++)
+    {
+        if ((hits->engines[e] != ENGINE_SDMA && hits->engines[e] != ENGINE_BLIT) ||
+            hits->is_imported[e])
+            continue;
+
+        if (engine >= 0)
+        {
+            fprintf(stderr, "Error: the sdma and blit engines cannot run in the same process, "
+                            "HSA_ENABLE_SDMA applies to all its copies.\n");
+            hits_abort(1);
+        }
+        engine = hits->engines[e];
+    }
+
+    if (engine < 0)
+        return;
+
+    const char *value = (engine == ENGINE_SDMA) ? "1" : "0";
+    if (sdma == NULL)
+        setenv("HSA_ENABLE_SDMA", value, 1);
+    else if ((strcmp(sdma, "0") == 0) != (engine == ENGINE_BLIT))
+    {
+        fprintf(stderr, "Error: the %s engine requires HSA_ENABLE_SDMA=%s (set to %s).\n",
+                engine_str[engine], value, sdma);
+        hits_abort(1);
+    }
+}
+
+static void check_plan(Hits_t *hits)
+{
+    if (hits->n_transfers == 0)
+    {
+        fprintf(stderr, "Error: the plan does not contain any transfer.\n");
+        hits_abort(1);
+    }
+
+    for (int i = 0; i < hits->n_transfers && hits->shape.height > 0; i++)
+        if (hits->transfer[i].type == MANAGED)
+        {
+            fprintf(stderr, "Error: strided copies do not apply to managed memory "
+                            "migrations.\n");
+            hits_abort(1);
+        }
+
+    if ((hits->alloc_flags & PAGEABLE_FLAGS) && (hits->alloc_flags & is_pinned))
+    {
+        fprintf(stderr, "Error: pageable allocation settings require pageable memory.\n");
+        hits_abort(1);
+    }
+
+    if ((hits->alloc_flags & is_hugepage) && (hits->alloc_flags & is_nohugepage))
+    {
+        fprintf(stderr, "Error: hugepage and nohugepage advices are exclusive.\n");
+        hits_abort(1);
+    }
+
+    /* Migrations already move pages out of caches at each iteration */
+    for (int i = 0; i < hits->n_transfers && hits->working_set > 0; i++)
+        if (hits->transfer[i].type == MANAGED)
+        {
+            fprintf(stderr, "Error: working set rotation does not apply to managed memory "
+                            "migrations.\n");
+            hits_abort(1);
+        }
+
+    check_sdma(hits);
+
+    for (int e = 0; e < hits->n_engines; e++)
+    {
+        if (hits->engines[e] != ENGINE_KERNEL || hits->is_imported[e])
+            continue;
+
+        /* Copy kernels access host memory through its device mapping */
+        if (!(hits->alloc_flags & is_pinned))
+        {
+            fprintf(stderr, "Error: the kernel engine requires pinned memory.\n");
+            hits_abort(1);
+        }
+
+        if (hits->shape.height > 0)
+        {
+            fprintf(stderr, "Error: the kernel engine does not support strided copies.\n");
+            hits_abort(1);
+        }
+
+        hits->alloc_flags = hits->alloc_flags | is_mapped;
+    }
+
+    if (hits->shape.height == 0)
+    {
+        if (hits->shape.pitch != 0)
+        {
+            fprintf(stderr, "Error: a row pitch requires strided copies.\n");
+            hits_abort(1);
+        }
+        return;
+    }
+
+    /* Strided buffers span the whole pitched area */
+    if (hits->shape.pitch == 0)
+        hits->shape.pitch = hits->shape.width;
+
+    if (hits->shape.pitch < hits->shape.width)
+    {
+        fprintf(stderr, "Error: the row pitch cannot be smaller than the row width.\n");
+        hits_abort(1);
+    }
+
+    if (hits->shape.pitch > (size_t)LONG_MAX / hits->shape.height / hits->shape.depth)
+    {
+        fprintf(stderr, "Error: the strided buffer size (pitch x height x depth) overflows.\n");
+        hits_abort(1);
+    }
+
+    hits->n_size = hits->shape.pitch * hits->shape.height * hits->shape.depth;
+}
+
+/**
+ * Read the memory available to new allocations on the host
+ *
+ * @return  Amount of bytes, 0 if unknown
+ */
+static size_t host_available_bytes(void)
+{
+    char line[256];
+    unsigned long long n_kbytes = 0;
+
+    FILE *file = fopen("/proc/meminfo", "r");
+    if (file == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+        if (sscanf(line, "MemAvailable: %llu kB", &n_kbytes) == 1)
+            break;
+
+    fclose(file);
+    return n_kbytes * 1024;
+}
+
+/**
+ * Check that host and device memory can hold all the buffers of the plan,
+ * so that large transfers fail early with a clear message instead of an
+ * out of memory error in the middle of the setup
+ *
+ * @param   hits[in]  Main application structure
+ */
+static void check_memory(const Hits_t *hits)
+{
+    int n_devices;
+    checkHip( hipGetDeviceCount(&n_devices) );
+
+    size_t *n_needed = (size_t *)calloc(n_devices + 1, sizeof(size_t));
+    assert(n_needed != NULL);
+    size_t *n_host = &n_needed[n_devices];
+
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        const Transfer_t *t = &hits->transfer[i];
+        const size_t n_bytes = pool_size_class(buffer_size(hits));
+
+        if (t->device >= n_devices || t->device2 >= n_devices)
+        {
+            fprintf(stderr, "Error: transfer %d uses a GPU id above %d.\n", i, n_devices - 1);
+            free(n_needed);
+            hits_abort(1);
+        }
+
+        switch (t->type)
+        {
+            case DTOD:
+                n_needed[t->device] += n_bytes;
+                n_needed[t->device2] += n_bytes;
+                break;
+            case MANAGED:
+                /* Pages are populated on the host, devices may evict them */
+                *n_host += hits->n_size;
+                break;
+            default:
+                n_needed[t->device] += n_bytes;
+                *n_host += n_bytes;
+                break;
+        }
+    }
+
+    for (int d = 0; d <= n_devices; d++)
+    {
+        size_t n_free = 0, n_total;
+
+        if (n_needed[d] == 0)
+            continue;
+
+        if (d < n_devices)
+        {
+            checkHip( hipSetDevice(d) );
+            checkHip( hipMemGetInfo(&n_free, &n_total) );
+        }
+        else if ((n_free = host_available_bytes()) == 0)
+            continue;
+
+        n_free += pool_free_bytes((d < n_devices) ? d : -1);
+        if (n_needed[d] <= n_free)
+            continue;
+
+        if (d < n_devices)
+            fprintf(stderr, "Error: transfers need %.2f GiB on Device %d but only %.2f GiB "
+                            "are free.\n", n_needed[d] / (double)(1 << 30), d,
+                    n_free / (double)(1 << 30));
+        else
+            fprintf(stderr, "Error: transfers need %.2f GiB of host memory but only %.2f GiB "
+                            "are available.\n", n_needed[d] / (double)(1 << 30),
+                    n_free / (double)(1 << 30));
+
+        free(n_needed);
+        hits_abort(1);
+    }
+
+    free(n_needed);
+}
+
+/**
+ * Query with move_pages where the pages of each host buffer landed, and warn
+ * about buffers which are not local to their GPU. Large buffers are sampled.
+ *
+ * @param   hits[inout]  Main application structure
+ */
+static void check_placement(Hits_t *hits)
+{
+    const long page_size = sysconf(_SC_PAGESIZE);
+    void **pages = (void **)malloc(sizeof(void *) * PLACEMENT_PAGES_MAX);
+    int *status = (int *)malloc(sizeof(int) * PLACEMENT_PAGES_MAX);
+    assert(pages != NULL && status != NULL);
+
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        Transfer_t *t = &hits->transfer[i];
+        const size_t n_pages = (t->n_bytes + page_size - 1) / page_size;
+        const size_t n_queried = (n_pages < PLACEMENT_PAGES_MAX) ? n_pages : PLACEMENT_PAGES_MAX;
+        size_t n_node[CPU_NODES_MAX] = { 0 }, n_absent = 0;
+
+        memset(t->host_pages, 0, sizeof(t->host_pages));
+        t->host_pages_absent = 0;
+        if (t->type != DTOH && t->type != HTOD)
+            continue;
+
+        char *buf = (char *)((t->type == DTOH) ? t->dest : t->src);
+        for (size_t p = 0; p < n_queried; p++)
+            pages[p] = buf + (p * n_pages / n_queried) * page_size;
+
+        if (numa_move_pages(0, n_queried, pages, NULL, status, 0) != 0)
+        {
+            fprintf(stderr, "Warning: cannot query the placement of host buffer pages (%s).\n",
+                    strerror(errno));
+            break;
+        }
+
+        /* Pageable pages not touched yet have no node (-ENOENT) */
+        for (size_t p = 0; p < n_queried; p++)
+            if (status[p] >= 0 && status[p] < CPU_NODES_MAX)
+                n_node[status[p]]++;
+            else
+                n_absent++;
+
+        for (int n = 0; n < CPU_NODES_MAX; n++)
+            t->host_pages[n] = 100.0 * n_node[n] / n_queried;
+        t->host_pages_absent = 100.0 * n_absent / n_queried;
+
+        if (hits->is_verbose)
+        {
+            printf("Transfer %d - Host buffer pages:", i);
+            for (int n = 0; n < CPU_NODES_MAX; n++)
+                if (n_node[n] > 0)
+                    printf(" node %d %.1f%%", n, t->host_pages[n]);
+            if (n_absent > 0)
+                printf(" not populated %.1f%%", t->host_pages_absent);
+            printf("\n");
+        }
+
+        const int local = gpu_numa_node(&t->prop_device);
+        if (local >= 0 && local < CPU_NODES_MAX && n_absent < n_queried &&
+            100.0 * n_node[local] / (n_queried - n_absent) < PLACEMENT_LOCAL_MIN)
+            fprintf(stderr, "Warning: only %.1f%% of the populated host buffer pages of "
+                            "Transfer %d are on node %d, local to Device %d.\n",
+                    100.0 * n_node[local] / (n_queried - n_absent), i, local, t->device);
+    }
+
+    free(pages);
+    free(status);
+}
+
+static void _setup(Hits_t *hits)
+{
+    if (hits->is_setup)
+    {
+        fprintf(stderr, "Error: the plan is already set up.\n");
+        hits_abort(1);
+    }
+
+    check_plan(hits);
+
+    if (hits->working_set > 0 && hits->working_set < 2 * (size_t)hits->n_size)
+    {
+        fprintf(stderr, "Error: the working set must hold at least two transfers (%ld bytes).\n",
+                2 * hits->n_size);
+        hits_abort(1);
+    }
+
+    check_memory(hits);
+    memset(&hits->alloc_stats, 0, sizeof(AllocStats_t));
+    transfer_init(hits);
+
+    if (hits->qos.device >= 0)
+        qos_init(hits, &hits->qos);
+
+    hits->is_setup = true;
+    check_placement(hits);
+
+    for (int i = 0; i < hits->n_transfers; i++)
+        transfer_peak(hits, &hits->transfer[i]);
+
+    if (hits->is_verbose)
+        printf("Buffers: %d allocated (%.3f GB) in %.3f seconds, %d reused from previous "
+               "plans (not included in bandwidth results)\n", hits->alloc_stats.n_allocated,
+               hits->alloc_stats.n_bytes / 1E9, hits->alloc_stats.seconds,
+               hits->alloc_stats.n_reused);
+}
+
+static void _run(Hits_t *hits)
+{
+    if (!hits->is_setup)
+    {
+        fprintf(stderr, "Error: the plan must be set up before running it.\n");
+        hits_abort(1);
+    }
+
+    for (int i = 0; i < hits->n_transfers; i++)
+        if ((size_t)hits->n_size > hits->transfer[i].n_bytes)
+        {
+            fprintf(stderr, "Error: the transfer size cannot exceed the %zu bytes allocated "
+                            "at setup.\n", hits->transfer[i].n_bytes);
+            hits_abort(1);
+        }
+
+    /* The trace covers the runs of the last call */
+    hits->n_trace = 0;
+
+    /* One run per compared engine, imported ones were run by another process */
+    for (int e = 0; e < hits->n_engines; e++)
+    {
+        if (hits->is_imported[e])
+            continue;
+
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            hits->transfer[i].engine         = hits->engines[e];
+            hits->transfer[i].n_corrupted[e] = -1;
+        }
+
+        run_transfers(hits, false, e, -1);
+
+        for (int i = 0; i < hits->n_transfers; i++)
+            transfer_link_check(hits, &hits->transfer[i], e);
+
+        /* Hot durations are kept aside, cold runs overwrite them */
+        for (int i = 0; i < hits->n_transfers; i++)
+        {
+            hits->transfer[i].dt_msec_engine[e] = hits->transfer[i].dt_msec;
+            hits->transfer[i].dt_msec_cold = 0;
+        }
+
+        if (hits->working_set > 0)
+        {
+            run_transfers(hits, true, -1, -1);
+
+            for (int i = 0; i < hits->n_transfers; i++)
+            {
+                hits->transfer[i].dt_msec_cold = hits->transfer[i].dt_msec;
+                hits->transfer[i].dt_msec = hits->transfer[i].dt_msec_engine[e];
+            }
+        }
+
+        if (hits->is_verbose)
+        {
+            hits_print_results(hits);
+            print_cpu_stats(hits, &hits->cpu[e]);
+            print_numa_stats(&hits->numa[e]);
+            print_dram_stats(&hits->dram[e]);
+
+            if (hits->qos.device >= 0)
+                hits_print_qos(&hits->qos);
+        }
+
+        for (int i = 0; i < hits->n_transfers; i++)
+            hits->transfer[i].dt_msec_cold_engine[e] = hits->transfer[i].dt_msec_cold;
+
+        if (hits->is_verify)
+            verify_transfers(hits, e);
+    }
+}
+
+void hits_plan_init(Hits_t *hits)
+{
+    memset(hits, 0, sizeof(Hits_t));
+
+    hits->n_iter        = N_ITER_DEFAULT;
+    hits->n_size        = N_SIZE_DEFAULT;
+    hits->alloc_flags   = is_numa_aware | is_pinned;
+    hits->engines[0]    = ENGINE_AUTO;
+    hits->n_engines     = 1;
+    hits->priority      = PRIORITY_NORMAL;
+    hits->qos.device    = -1;
+    hits->qos.n_bytes   = QOS_SIZE_DEFAULT;
+    hits->seed          = VERIFY_SEED_DEFAULT;
+    hits->wait          = WAIT_AUTO;
+    hits->health_min    = HEALTH_MIN_DEFAULT;
+}
+
+int hits_plan_add(Hits_t *hits, const TransferType_t type, const int device, const int device2)
+{
+    if (hits->is_setup)
+    {
+        fprintf(stderr, "Error: transfers cannot be added to a plan already set up.\n");
+        return -1;
+    }
+
+    if (device < 0 || (type == DTOD && device2 < 0))
+    {
+        fprintf(stderr, "Error: invalid GPU id for a %s transfer.\n", ttype_str[type]);
+        return -1;
+    }
+
+    if (hits->n_transfers == hits->n_alloc)
+    {
+        const int n_alloc = (hits->n_alloc > 0) ? hits->n_alloc * 2 : 8;
+        Transfer_t *transfer = (Transfer_t *)realloc(hits->transfer, sizeof(Transfer_t) * n_alloc);
+        if (transfer == NULL)
+        {
+            fprintf(stderr, "Error: cannot allocate the transfer array.\n");
+            return -1;
+        }
+
+        hits->transfer = transfer;
+        hits->n_alloc  = n_alloc;
+    }
+
+    Transfer_t *t = &hits->transfer[hits->n_transfers];
+    memset(t, 0, sizeof(Transfer_t));
+    t->type     = type;
+    t->device   = device;
+    t->device2  = (type == DTOD) ? device2 : -1;
+    t->priority = hits->priority;
+
+    return hits->n_transfers++;
+}
+
+int hits_import_results(Hits_t *hits, const int e, const Result_t *results, const int n)
+{
+    if (!hits->is_setup || e < 0 || e >= hits->n_engines || !hits->is_imported[e])
+    {
+        fprintf(stderr, "Error: results can only be imported for engines flagged as imported "
+                        "in a plan set up.\n");
+        return 1;
+    }
+
+    if (n != hits->n_transfers)
+    {
+        fprintf(stderr, "Error: %d results imported for %d transfers.\n", n, hits->n_transfers);
+        return 1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        Transfer_t *t = &hits->transfer[i];
+        const Result_t *r = &results[i];
+        Result_t expected;
+
+        get_result(hits, t, e, &expected);
+        if (strcmp(r->type, expected.type) != 0 || strcmp(r->bdf, expected.bdf) != 0 ||
+            strcmp(r->peer_bdf, expected.peer_bdf) != 0 || r->n_bytes != expected.n_bytes ||
+            r->n_iter != expected.n_iter)
+        {
+            fprintf(stderr, "Error: imported result %d (%s %s) does not match transfer %d.\n",
+                    i, r->type, r->bdf, i);
+            return 1;
+        }
+
+        t->dt_msec_engine[e] = r->seconds * 1E3;
+        t->dt_msec_cold_engine[e] = (r->gbps_cold > 0) ? r->seconds * 1E3 * r->gbps / r->gbps_cold
+                                                       : 0;
+        t->n_corrupted[e] = r->n_corrupted;
+        t->is_link_down[e] = r->is_link_down;
+    }
+
+    /* Only the CPU cost per GB of the run is known */
+    memset(&hits->cpu[e], 0, sizeof(CpuStats_t));
+    hits->cpu[e].user = (n > 0) ? results[0].cpu_sec_per_gb : 0;
+    hits->cpu[e].n_gbytes = 1;
+
+    return 0;
+}
+
+int hits_setup(Hits_t *hits)
+{
+    return _hits_call(_setup, hits);
+}
+
+int hits_run(Hits_t *hits)
+{
+    return _hits_call(_run, hits);
+}
+
+int hits_offset_sweep(Hits_t *hits)
+{
+    return _hits_call(_offset_sweep, hits);
+}
+
+int hits_healthcheck(Hits_t *hits)
+{
+    return _hits_call(_healthcheck, hits);
+}
+
+int hits_alloc_bench(Hits_t *hits)
+{
+    return _hits_call(_alloc_bench, hits);
+}
+
+int hits_fini(Hits_t *hits)
+{
+    int err = 0;
+
+    if (hits->qos.device >= 0 && hits->is_setup)
+        qos_fini(&hits->qos, &err);
+
+    /* Buffers go back to the pool, transfers of a failed setup are partly initialized */
+    for (int i = 0; i < hits->n_transfers; i++)
+    {
+        Transfer_t *t = &hits->transfer[i];
+
+        if (t->type == MANAGED)
+        {
+            if (t->src != NULL)
+                releaseHip( hipFree(t->src), &err );
+        }
+        else
+        {
+            pool_put(t->src);
+            pool_put(t->dest);
+        }
+
+        if (t->stream == NULL)
+            continue;
+
+        releaseHip( hipSetDevice(t->device), &err );
+        releaseHip( hipStreamDestroy(t->stream), &err );
+        releaseHip( hipEventDestroy(t->start), &err );
+        releaseHip( hipEventDestroy(t->stop), &err );
+
+        for (long k = 0; k < t->n_trace_events; k++)
+            releaseHip( hipEventDestroy(t->trace_events[k]), &err );
+        free(t->trace_events);
+    }
+
+    free(hits->trace);
+    hits->trace         = NULL;
+    hits->n_trace       = 0;
+    hits->n_trace_alloc = 0;
+
+    free(hits->transfer);
+    hits->transfer    = NULL;
+    hits->n_transfers = 0;
+    hits->n_alloc     = 0;
+    hits->is_setup    = false;
+
+    return err;
+}
@@ -0,0 +1,443 @@
+/**
+* HIP Transfer Streams (HIts) library: plan transfer streams, run them as many
+*                                      times as needed with the same buffers
+*                                      and fetch structured results.
+* URL       https://github.com/jyvet/hits
+* License   MIT
+* Author    Jean-Yves VET <contact[at]jean-yves.vet>
+* Copyright (c) 2023
+******************************************************************************/
+
+#ifndef LIBHITS_H
+#define LIBHITS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <hip/hip_runtime.h>
+
+#define N_SIZE_DEFAULT  1073741824  /* 1GiB */
+#define N_ITER_DEFAULT  100
+#define QOS_SIZE_DEFAULT        65536       /* 64KiB probe copies */
+#define VERIFY_SEED_DEFAULT     0x68697473  /* "hits" */
+#define HITS_VERSION    "hits 1.1"
+#define OFFSETS_MAX     16          /* Offsets of an offset sweep */
+#define HOST_ALLOC_STR_MAX      48  /* Description of host buffer allocations */
+#define CPU_NODES_MAX   16          /* NUMA nodes of CPU accounting */
+#define SOCKETS_MAX     8           /* Sockets of DRAM traffic counters */
+#define HEALTH_MIN_DEFAULT      70  /* Percent of the theoretical link bandwidth */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum TransferType
+{
+    HTOD = 0,  /* Host memory to Device (GPU)  */
+    DTOH,      /* Device (GPU) to Host memory  */
+    DTOD,      /* Device (GPU) to Device (GPU) */
+    MANAGED,   /* Managed memory migrated between host and device */
+} TransferType_t;
+
+typedef enum Engine
+{
+    ENGINE_AUTO = 0,  /* hipMemcpy*Async (SDMA or blit, HSA_ENABLE_SDMA) */
+    ENGINE_SDMA,      /* Same on SDMA engines (HSA_ENABLE_SDMA=1, NoCU)  */
+    ENGINE_BLIT,      /* Same as blit kernels (HSA_ENABLE_SDMA=0)        */
+    ENGINE_KERNEL,    /* In-tree grid-stride copy kernel                 */
+    ENGINE_COUNT,
+} Engine_t;
+
+typedef enum Priority
+{
+    PRIORITY_LOW = 0,
+    PRIORITY_NORMAL,
+    PRIORITY_HIGH,
+    PRIORITY_COUNT,
+} Priority_t;
+
+typedef enum Wait
+{
+    WAIT_AUTO = 0,    /* hipDeviceSynchronize with the default scheduling */
+    WAIT_SPIN,        /* hipEventSynchronize, spinning scheduling mode     */
+    WAIT_YIELD,       /* hipEventSynchronize, yielding scheduling mode     */
+    WAIT_BLOCKING,    /* hipEventSynchronize on blocking sync events       */
+    WAIT_CALLBACK,    /* hipLaunchHostFunc notifications                   */
+    WAIT_COUNT,
+} Wait_t;
+
+typedef struct Transfer
+{
+    hipEvent_t      start;      /* Start event for timing purpose                */
+    hipEvent_t      stop;       /* Stop event for timing purpose                 */
+    int             device;     /* First (or single) device involved in transfer */
+    int             device2;    /* Second device involved in the transfer        */
+    float          *dest;       /* Source buffer (host or GPU memory)            */
+    float          *src;        /* Destination buffer (host or GPU memory)       */
+    hipStream_t     stream;     /* HIP stream dedicated to the transfer          */
+    TransferType_t  type;       /* Type and direction of the transfer            */
+    int             numa_node;  /* NUMA node locality                            */
+    bool            is_started; /* True if at least one stream event submitted   */
+    size_t          n_bytes;    /* Size of the transfer buffers                  */
+    float          *mapped;     /* Device address of the mapped host buffer      */
+    Engine_t        engine;     /* Engine performing the copies                  */
+    Priority_t      priority;   /* Priority of the stream                        */
+    float           dt_msec;    /* Duration of the last run                      */
+    float           dt_msec_engine[ENGINE_COUNT]; /* Duration with each engine  */
+    float           dt_msec_cold;  /* Duration of the last working-set rotation  */
+    float           dt_msec_cold_engine[ENGINE_COUNT]; /* Same, with each engine */
+    long            n_corrupted[ENGINE_COUNT]; /* Corrupted iterations (-1 if not verified) */
+    uint64_t        n_faults;   /* Host page faults (managed demand migrations)  */
+    float           host_pages[CPU_NODES_MAX]; /* Host buffer pages per node (%) */
+    float           host_pages_absent; /* Host buffer pages not populated (%)    */
+    hipEvent_t     *trace_events; /* Anchor and end of each iteration (tracing)  */
+    double          peak_gbps;  /* Theoretical bandwidth of the link (0 if unknown) */
+    char            link[32];   /* Description of the link                       */
+    bool            is_pcie;    /* The theoretical bandwidth is the one of PCIe  */
+    double          link_speed; /* Rate of a link trained down in the last run (0 if none) */
+    int             link_width; /* Lanes of the link trained down                */
+    bool            is_link_down[ENGINE_COUNT]; /* Link below its maximum after each engine run */
+    long            n_trace_events; /* Amount of created trace events            */
+    struct hipDeviceProp_t prop_device;
+    struct hipDeviceProp_t prop_device2;
+} Transfer_t;
+
+typedef struct Shape
+{
+    size_t  width;      /* Width of a row in bytes                       */
+    size_t  height;     /* Amount of rows in a slice (0 if not strided)  */
+    size_t  depth;      /* Amount of slices                              */
+    size_t  pitch;      /* Distance in bytes between two rows            */
+} Shape_t;
+
+/* Latency samples of QoS probe copies */
+typedef struct Latency
+{
+    double     *usec;       /* Latency of each probe copy in microseconds   */
+    size_t      n;          /* Amount of samples                             */
+} Latency_t;
+
+/* Small copies measuring how stream priorities protect latency under load */
+typedef struct QosProbe
+{
+    int             device;     /* GPU id of the probe (-1 if disabled)         */
+    size_t          n_bytes;    /* Size of each probe copy                       */
+    void           *src;        /* Pinned host source buffer                     */
+    void           *dest;       /* Device destination buffer                     */
+    hipStream_t     stream[2];  /* Streams at normal and high priority           */
+    Latency_t       idle[2];    /* Samples per priority while GPUs are idle      */
+    Latency_t       loaded[2];  /* Samples per priority while transfers run      */
+    const bool     *is_running; /* Stop flag of the loaded sampling              */
+    int             status;     /* Error code of the loaded sampling (0 if none) */
+} QosProbe_t;
+
+/* Host CPU time spent while the transfers of a run were in flight */
+typedef struct CpuStats
+{
+    double      seconds;        /* Wall-clock duration of the window          */
+    double      user;           /* Process user CPU-seconds                   */
+    double      sys;            /* Process system CPU-seconds                 */
+    double      n_gbytes;       /* GB moved by all transfers of the run       */
+    int         n_threads;      /* Process threads which consumed CPU time    */
+    double      thread_max;     /* CPU-seconds of the busiest thread          */
+    char        thread_name[16]; /* Name of the busiest thread                */
+    double      node[CPU_NODES_MAX]; /* Busy CPU-seconds per NUMA node (all
+                                        processes of the system)              */
+    int         n_nodes;        /* Amount of NUMA nodes                       */
+    double      wait_usec;      /* Delay between the end of the longest
+                                   transfer and its detection by the host     */
+} CpuStats_t;
+
+/* Copy of one iteration, on the host clock */
+typedef struct TraceSpan
+{
+    int         transfer;       /* Index of the transfer                      */
+    Engine_t    engine;         /* Engine performing the copy                 */
+    long        iter;           /* Iteration                                  */
+    bool        is_cold;        /* Copy of a working-set rotation             */
+    double      begin_usec;     /* Start since the first traced run           */
+    double      end_usec;       /* End since the first traced run             */
+} TraceSpan_t;
+
+/* NUMA allocation statistics and page migrations during a run */
+typedef struct NumaStats
+{
+    int         n_nodes;                /* Amount of NUMA nodes                   */
+    long        hit[CPU_NODES_MAX];     /* Pages allocated on the intended node   */
+    long        miss[CPU_NODES_MAX];    /* Pages allocated here, intended elsewhere */
+    long        foreign[CPU_NODES_MAX]; /* Pages intended here, allocated elsewhere */
+    long        pgmigrate_success;      /* Pages migrated between nodes           */
+    long        numa_pages_migrated;    /* Pages migrated by NUMA balancing       */
+} NumaStats_t;
+
+/* DRAM traffic counted by uncore memory controllers during a run */
+typedef struct DramStats
+{
+    int         n_sockets;          /* Sockets with counters (0 if not counted) */
+    double      read[SOCKETS_MAX];  /* Bytes read from the DRAM of each socket  */
+    double      write[SOCKETS_MAX]; /* Bytes written to the DRAM of each socket */
+    double      seconds;            /* Duration of the counting window          */
+} DramStats_t;
+
+/* Bandwidth of a transfer measured with one engine, as stored in result files */
+typedef struct Result
+{
+    char        type[16];       /* Transfer type key                          */
+    char        engine[16];     /* Copy engine                                */
+    char        bdf[16];        /* PCI address of the (destination) device    */
+    char        peer_bdf[16];   /* PCI address of the source device or "-"    */
+    size_t      n_bytes;        /* Transfer size                              */
+    long        n_iter;         /* Amount of iterations                       */
+    double      seconds;        /* Duration of all iterations                 */
+    double      gbps;           /* Bandwidth (payload, both ways if managed)  */
+    double      gbps_cold;      /* Bandwidth over the working set (0 if none) */
+    long        n_corrupted;    /* Corrupted iterations (-1 if not verified)  */
+    char        host_alloc[HOST_ALLOC_STR_MAX]; /* Host buffer allocation path */
+    double      cpu_sec_per_gb; /* Process CPU-seconds per GB moved by the run */
+    double      peak_gbps;      /* Theoretical bandwidth of the link (0 if unknown) */
+    double      efficiency;     /* Percentage of the theoretical bandwidth    */
+    bool        is_link_down;   /* PCIe link below its maximum after the run  */
+    bool        is_used;        /* Already matched (baseline entries)         */
+} Result_t;
+
+/* Cost of the buffer allocations of a plan */
+typedef struct AllocStats
+{
+    int         n_allocated;    /* Buffers allocated (and pinned) at setup    */
+    int         n_reused;       /* Buffers handed out again by the pool       */
+    size_t      n_bytes;        /* Bytes allocated at setup                   */
+    double      seconds;        /* Time spent allocating                      */
+} AllocStats_t;
+
+enum Flags
+{
+    is_numa_aware = 1 << 0,
+    is_pinned     = 1 << 1,
+    is_mapped     = 1 << 2,
+    is_populate   = 1 << 3,   /* Populate pageable buffers at allocation  */
+    is_hugepage   = 1 << 4,   /* madvise(MADV_HUGEPAGE) pageable buffers  */
+    is_nohugepage = 1 << 5,   /* madvise(MADV_NOHUGEPAGE) pageable buffers */
+    is_first_touch = 1 << 6,  /* Touch pageable pages from the GPU node   */
+};
+
+typedef struct Hits
+{
+    Transfer_t *transfer;      /* Array containing all transfers to launch     */
+    int         n_transfers;   /* Amount of transfers                          */
+    int         n_alloc;       /* Capacity of the transfer array               */
+    long        n_iter;        /* Amount of iterations for each transfer       */
+    long        n_size;        /* Transfer size in bytes                       */
+    int         alloc_flags;   /* Allocation flags (NUMA, pinned, pageable)    */
+    Shape_t     shape;         /* Geometry of pitched (2D/3D) transfers        */
+    bool        is_demand_fault; /* Migrate managed memory back with CPU faults */
+    bool        is_verify;     /* Check destination contents after the run     */
+    bool        is_dram_counters; /* Count DRAM traffic with uncore counters    */
+    bool        is_trace;      /* Time each iteration for hits_write_trace     */
+    TraceSpan_t *trace;        /* Iterations of the runs of the last call      */
+    size_t      n_trace;       /* Amount of traced iterations                  */
+    size_t      n_trace_alloc; /* Capacity of the trace array                  */
+    double      trace_epoch;   /* Host time origin of the trace                */
+    const char *sysfs_root;    /* Root of sysfs (fixture trees), NULL for /sys */
+    double      health_min;    /* Minimum link efficiency (%) of health checks */
+    int         n_unhealthy;   /* Degraded links found by the last check       */
+    Engine_t    engines[ENGINE_COUNT]; /* Engines to compare, one run each     */
+    int         n_engines;     /* Amount of engines to compare                 */
+    bool        is_imported[ENGINE_COUNT]; /* Engines run by another process */
+    Priority_t  priority;      /* Stream priority of next declared transfers   */
+    Wait_t      wait;          /* Strategy waiting for transfer completions    */
+    QosProbe_t  qos;           /* Latency probe running alongside transfers    */
+    uint64_t    seed;          /* Seed of the verification pattern             */
+    size_t      working_set;   /* Bytes rotated over by cold runs (0 if none)  */
+    size_t      offsets[OFFSETS_MAX]; /* Byte offsets of the offset sweep        */
+    int         n_offsets;     /* Amount of swept offsets (0 if no sweep)      */
+    size_t      src_offset;    /* Offset of copies in source buffers           */
+    size_t      dest_offset;   /* Offset of copies in destination buffers      */
+    bool        is_verbose;    /* Print progress and results of each run       */
+    bool        is_setup;      /* Buffers, streams and events are allocated    */
+    AllocStats_t alloc_stats;  /* Cost of the buffer allocations at setup      */
+    CpuStats_t  cpu[ENGINE_COUNT]; /* Host CPU cost of the run of each engine  */
+    NumaStats_t numa[ENGINE_COUNT]; /* NUMA statistics of the run of each engine */
+    DramStats_t dram[ENGINE_COUNT]; /* DRAM traffic of the run of each engine  */
+} Hits_t;
+
+extern const char * const ttype_str[];    /* Transfer type descriptions          */
+extern const char * const ttype_key[];    /* Transfer type names in result files */
+extern const char * const engine_str[];   /* Engine names                        */
+extern const char * const priority_str[]; /* Priority names                      */
+extern const char * const wait_str[];     /* Wait strategy names                 */
+
+/*
+ * API calls returning an int give 0 on success. On failure, an error message
+ * is printed on stderr and the HIP error code (or 1 for other errors) is
+ * returned. A failing plan should then be released with hits_fini.
+ */
+
+/**
+ * Initialize a plan with default settings and no transfer
+ *
+ * @param   hits[out]  Plan to initialize
+ */
+void hits_plan_init(Hits_t *hits);
+
+/**
+ * Add a transfer to the plan. The stream priority of the transfer is the
+ * current priority of the plan.
+ *
+ * @param   hits[inout]  Plan
+ * @param   type[in]     Type and direction of the transfer
+ * @param   device[in]   GPU id (destination GPU id for DTOD)
+ * @param   device2[in]  Source GPU id for DTOD, ignored otherwise
+ * @return  Index of the transfer, -1 if it cannot be added
+ */
+int hits_plan_add(Hits_t *hits, const TransferType_t type, const int device, const int device2);
+
+/**
+ * Check the plan, then allocate buffers, streams and events of all
+ * transfers. They are kept until hits_fini, so that runs can be repeated
+ * without paying the initialization again.
+ *
+ * @param   hits[inout]  Plan
+ * @return  0 on success
+ */
+int hits_setup(Hits_t *hits);
+
+/**
+ * Run the plan: all transfers concurrently, once per compared engine, with
+ * the optional verification pass and QoS probe. With a working set, each
+ * engine runs twice: hot on a fixed window, then cold on a window moving
+ * through the working set at each iteration. The transfer size may be
+ * lowered between runs, up to the size of the buffers allocated at setup.
+ *
+ * @param   hits[inout]  Plan set up with hits_setup
+ * @return  0 on success
+ */
+int hits_run(Hits_t *hits);
+
+/**
+ * Run the plan once for each pair of source and destination offsets, with
+ * the first compared engine, and print a bandwidth table per transfer.
+ * Buffers have room for the largest offset when the plan is set up with
+ * offsets.
+ *
+ * @param   hits[inout]  Plan set up with hits_setup
+ * @return  0 on success
+ */
+int hits_offset_sweep(Hits_t *hits);
+
+/**
+ * Probe each host transfer of the plan alone and compare its bandwidth with
+ * the theoretical bandwidth of the current PCIe link of its GPU (sysfs
+ * current_link_* and max_link_*). A link is degraded when it runs below its
+ * maximum speed or width, or when the probe reaches less than health_min
+ * percent of its bandwidth. Results are printed on stdout and the amount of
+ * degraded links is stored in n_unhealthy.
+ *
+ * @param   hits[inout]  Plan set up with hits_setup
+ * @return  0 on success
+ */
+int hits_healthcheck(Hits_t *hits);
+
+/**
+ * Time hipHostMalloc, hipHostRegister, numa_alloc_onnode (with first touch)
+ * and hipMalloc, with their free or unregister calls, on the GPUs of the
+ * plan and on each NUMA node. Buffer sizes grow by 16x from 4KiB up to the
+ * transfer size of the plan, with up to n_iter allocations of each size. The
+ * plan does not need to be set up. Results are printed on stdout.
+ *
+ * @param   hits[in]  Plan
+ * @return  0 on success
+ */
+int hits_alloc_bench(Hits_t *hits);
+
+/**
+ * Fetch the results of the last run, one per transfer and compared engine
+ *
+ * @param   hits[in]       Plan
+ * @param   results[out]   Array receiving results (NULL to only count them)
+ * @param   n_max[in]      Capacity of the array
+ * @return  Amount of results available
+ */
+int hits_get_results(const Hits_t *hits, Result_t *results, const int n_max);
+
+/**
+ * Import the results of one of the compared engines, run by another process
+ * on the same plan. The engine must be flagged in is_imported before
+ * hits_setup: it is then neither checked nor run by this process. The sdma
+ * and blit engines set HSA_ENABLE_SDMA, which the runtime reads once per
+ * process, so only one of them can run in a process.
+ *
+ * @param   hits[inout]    Plan set up
+ * @param   e[in]          Index of the engine in the compared engines
+ * @param   results[in]    Results of the engine, one per transfer in plan order
+ * @param   n[in]          Amount of results
+ * @return  0 on success, 1 if the results do not match the plan
+ */
+int hits_import_results(Hits_t *hits, const int e, const Result_t *results, const int n);
+
+/**
+ * Release all resources of the plan. Buffers are given back to the pool of
+ * the process, to be reused by later plans with the same NUMA node, size
+ * class and allocation flags. Errors do not stop the release, the first one
+ * is returned.
+ *
+ * @param   hits[inout]  Plan
+ * @return  0 on success
+ */
+int hits_fini(Hits_t *hits);
+
+/**
+ * Free the pooled buffers that no plan currently uses. Buffers that fail to
+ * be freed are reported on stderr and dropped from the pool.
+ *
+ * @return  Amount of bytes released
+ */
+size_t hits_pool_release(void);
+
+/* Reporting helpers (text on stdout, CSV result files, JSON lines) */
+void hits_print_results(const Hits_t *hits);
+void hits_print_qos(QosProbe_t *q);
+void hits_print_engine_comparison(const Hits_t *hits);
+int  hits_write_results(const Hits_t *hits, const char *path);
+void hits_print_json(const Hits_t *hits, FILE *file);
+
+/**
+ * Write the iterations of the last run (or offset sweep) of a plan with
+ * is_trace set as a Chrome trace-event JSON file (chrome://tracing,
+ * Perfetto), one track per transfer stream and one span per copy
+ *
+ * @param   hits[in]  Plan
+ * @param   path[in]  Trace file
+ * @return  0 on success, 1 if the file cannot be written
+ */
+int  hits_write_trace(const Hits_t *hits, const char *path);
+
+/**
+ * Atomically write the results of the last run as a Prometheus textfile
+ * (node_exporter textfile collector): bandwidth, copy duration quantiles
+ * (if is_trace is set), QoS probe latency quantiles and NUMA placement of
+ * host buffers, labelled by PCI address and direction
+ *
+ * @param   hits[in]  Plan
+ * @param   path[in]  Metric file, replaced by renaming a temporary file
+ * @return  0 on success, 1 if the file cannot be written
+ */
+int  hits_write_prometheus(Hits_t *hits, const char *path);
+
+/**
+ * Compare the results of the last run with a file written by
+ * hits_write_results. Results are matched by transfer type, engine, PCI
+ * addresses and size.
+ *
+ * @param   hits[in]       Plan
+ * @param   path[in]       Baseline result file
+ * @param   tolerance[in]  Accepted bandwidth drop in percent
+ * @return  Amount of regressions, -1 if the baseline cannot be read
+ */
+int hits_check_baseline(const Hits_t *hits, const char *path, const double tolerance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBHITS_H */
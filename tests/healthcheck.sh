@@ -0,0 +1,46 @@
+#!/bin/sh
+# Run --healthcheck on the host transfer of device 0 against the sysfs fixtures of tests/sysfs,
+# each one staged under the PCIe address of that device.
+#   Usage: tests/healthcheck.sh [path to hits]
+
+HITS=${1:-./hits}
+FIXTURES=$(dirname "$0")/sysfs
+ROOT=$(mktemp -d) || exit 1
+trap 'rm -rf "$ROOT"' EXIT
+fail=0
+
+# Address of device 0, printed by a healthcheck without any link in sysfs
+bdf=$("$HITS" --htod=0 --healthcheck --sysfs-root="$ROOT" | sed -n 's/.*Device 0 (\([^)]*\)).*/\1/p')
+if [ -z "$bdf" ]; then
+    echo "FAIL: no PCIe address reported for device 0"
+    exit 1
+fi
+
+# check <fixture> <expected exit status, empty for any> <expected output> [unexpected output]
+check() {
+    rm -rf "$ROOT/bus"
+    mkdir -p "$ROOT/bus/pci/devices/$bdf"
+    cp "$FIXTURES/$1"/* "$ROOT/bus/pci/devices/$bdf/"
+    out=$("$HITS" --htod=0 --healthcheck --sysfs-root="$ROOT")
+    ret=$?
+
+    if [ -n "$2" ] && [ "$ret" -ne "$2" ]; then
+        err="exited with $ret instead of $2"
+    elif ! echo "$out" | grep -qF "$3"; then
+        err="does not report '$3'"
+    elif [ -n "$4" ] && echo "$out" | grep -qF "$4"; then
+        err="reports '$4'"
+    else
+        echo "PASS: $1"
+        return
+    fi
+    echo "FAIL: $1 $err"
+    echo "$out"
+    fail=1
+}
+
+# Throughput depends on the actual link, only the link and its peak are checked when healthy
+check x8-gen3 "" "link PCIe 8.0 GT/s x8 (7.88 GB/s theoretical)," "trained down"
+check x8-gen3-down 3 "trained down to 8.0 GT/s x4"
+
+exit $fail